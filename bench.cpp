@@ -0,0 +1,710 @@
+/*
+ * Benchmarks of collections.cpp, built on Google Benchmark.
+ *
+ * Sizes run from 1K keys up to 1M, or up to COLLECTIONS_BENCH_MAX_SIZE keys
+ * when set, by powers of ten. Keys are 64 bit integers drawn as
+ *   - uniform: every key of a universe of n keys equally likely,
+ *   - zipf: the rank r of a universe of n keys with a probability in 1/r,
+ *   - sorted: uniform keys in increasing order, so with runs of equal keys,
+ * scattered over the 64 bit range so that hashing them is not trivial. Each
+ * benchmark reports items per second, an item being a key looked up,
+ * counted or merged.
+ */
+
+#define COLLECTIONS_NO_MAIN
+#include "collections.cpp"
+
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+
+namespace {
+
+enum dist { uniform, zipf, sorted };
+
+int64_t max_size() {
+    const char* s = std::getenv("COLLECTIONS_BENCH_MAX_SIZE");
+    int64_t n = s ? std::atoll(s) : 0;
+    return n > 0 ? n : 1000000;
+}
+
+uint64_t scatter(uint64_t x) { return x * 0x9e3779b97f4a7c15ULL; }
+
+// n keys over a universe of n distinct ones. Zipfian ranks invert the
+// continuous distribution of density 1/x, close to a Zipf law of exponent 1.
+std::vector<uint64_t> make_keys(size_t n, int d, uint64_t seed = 1) {
+    std::mt19937_64 g(seed);
+    std::uniform_real_distribution<double> u(0, 1);
+    std::vector<uint64_t> v(n);
+    double l = std::log(double(n) + 1);
+    for (auto &k : v) {
+        uint64_t r = d == zipf ? uint64_t(std::exp(u(g) * l)) - 1 : g() % n;
+        k = scatter(r);
+    }
+    if (d == sorted) std::sort(v.begin(), v.end());
+    return v;
+}
+
+// n distinct keys, in an unpredictable order.
+std::vector<uint64_t> distinct_keys(size_t n) {
+    std::vector<uint64_t> v(n);
+    for (size_t i = 0; i < n; ++i) v[i] = scatter(i + 1);
+    std::shuffle(v.begin(), v.end(), std::mt19937_64(2));
+    return v;
+}
+
+void sizes(benchmark::internal::Benchmark* b) {
+    for (int64_t n = 1000; n <= max_size(); n *= 10) b->Arg(n);
+}
+
+void sizes_and_dists(benchmark::internal::Benchmark* b) {
+    for (int64_t n = 1000; n <= max_size(); n *= 10)
+        for (int d : {uniform, zipf, sorted}) b->Args({n, d});
+}
+
+void set_label(benchmark::State& state) {
+    static const char* names[] = {"uniform", "zipf", "sorted"};
+    state.SetLabel(names[state.range(1)]);
+}
+
+typedef defaultdict<uint64_t, int> std_dict;
+typedef flat_defaultdict<uint64_t, int> flat_dict;
+// Same, counting its lookups, probes and growth.
+typedef flat_defaultdict<uint64_t, int, int (*)(), lookup_stats> stats_dict;
+typedef Counter<uint64_t> std_counter;
+typedef flat_counter<uint64_t> flat_counter64;
+typedef std::unordered_map<uint64_t, int> std_map;
+typedef flat_map<uint64_t, int> flat_map64;
+
+int zero() { return 0; }
+
+//-----defaultdict-----
+template<class D>
+void BM_defaultdict_hit(benchmark::State& state) {
+    auto keys = distinct_keys(state.range(0));
+    D d(zero);
+    for (uint64_t k : keys) d[k] = 1;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(3));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(d[keys[i]]);
+        if (++i == keys.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_defaultdict_hit, std_dict)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_defaultdict_hit, flat_dict)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_defaultdict_hit, stats_dict)->Apply(sizes);
+
+// Every lookup misses and inserts a default value.
+template<class D>
+void BM_defaultdict_miss(benchmark::State& state) {
+    auto keys = distinct_keys(state.range(0));
+    for (auto _ : state) {
+        D d(zero);
+        for (uint64_t k : keys) benchmark::DoNotOptimize(d[k]);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK_TEMPLATE(BM_defaultdict_miss, std_dict)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_defaultdict_miss, flat_dict)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_defaultdict_miss, stats_dict)->Apply(sizes);
+
+template<class D>
+void BM_defaultdict_get_many(benchmark::State& state) {
+    auto keys = distinct_keys(state.range(0));
+    D d(zero);
+    for (uint64_t k : keys) d[k] = 1;
+    auto probe = make_keys(keys.size(), uniform, 4);
+    for (auto &k : probe) k = keys[k % keys.size()];
+    std::vector<int*> out(probe.size());
+    for (auto _ : state) {
+        d.get_many(probe, out.begin());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * probe.size());
+}
+BENCHMARK_TEMPLATE(BM_defaultdict_get_many, std_dict)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_defaultdict_get_many, flat_dict)->Apply(sizes);
+
+// A memoization cache of a tenth of the Zipfian keys it is asked for, as
+// a clock_defaultdict, with the hit rate it gets as the hits counter.
+void BM_clock_defaultdict(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), zipf);
+    auto d = make_clock_defaultdict<uint64_t>(keys.size() / 10, zero);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(d[keys[i]]);
+        if (++i == keys.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["hits"] = 1 - d.stats().miss_rate();
+}
+BENCHMARK(BM_clock_defaultdict)->Apply(sizes);
+
+// The same, shared by threads through a concurrent_defaultdict.
+void BM_concurrent_defaultdict(benchmark::State& state) {
+    typedef concurrent_defaultdict<uint64_t, int> D;
+    static D* d;
+    static std::vector<uint64_t> keys;
+    if (state.thread_index() == 0) {
+        keys = make_keys(1000000, zipf);
+        d = new D(keys.size() / 10, zero, 64);
+    }
+    size_t i = size_t(state.thread_index()) * 7919;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(d->get(keys[i % keys.size()]));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        state.counters["hits"] = 1 - d->stats().miss_rate();
+        delete d;
+    }
+}
+BENCHMARK(BM_concurrent_defaultdict)
+        ->Threads(1)->Threads(8)->Threads(32)->UseRealTime();
+
+// Lookups of std::string keys from a std::string_view, with a transparent
+// hash or by building a std::string each time.
+template<class Map>
+void BM_string_view_lookup(benchmark::State& state) {
+    std::vector<std::string> keys;
+    for (uint64_t k : distinct_keys(state.range(0)))
+        keys.push_back("key:" + std::to_string(k));
+    defaultdict<std::string, int, Map> d([]() { return 0; });
+    for (auto &k : keys) d[k] = 1;
+    size_t i = 0;
+    for (auto _ : state) {
+        std::string_view k = keys[i];
+        if constexpr (is_transparent_map<Map>::value)
+            benchmark::DoNotOptimize(d[k]);
+        else
+            benchmark::DoNotOptimize(d[std::string(k)]);
+        if (++i == keys.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_string_view_lookup, flat_map<std::string, int>)
+        ->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_string_view_lookup,
+                   flat_map<std::string, int, string_hash, std::equal_to<>>)
+        ->Apply(sizes);
+
+//-----Counter-----
+template<class C>
+void BM_Counter_update(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), int(state.range(1)));
+    for (auto _ : state) {
+        C c;
+        c.update(keys);
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_label(state);
+}
+BENCHMARK_TEMPLATE(BM_Counter_update, std_counter)->Apply(sizes_and_dists);
+BENCHMARK_TEMPLATE(BM_Counter_update, flat_counter64)->Apply(sizes_and_dists);
+
+// ++c[k] on every key, against the batched, prefetching increment_many.
+template<class C>
+void BM_Counter_increment(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), int(state.range(1)));
+    C c;
+    for (auto _ : state) {
+        for (uint64_t k : keys) ++c[k];
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_label(state);
+}
+BENCHMARK_TEMPLATE(BM_Counter_increment, std_counter)->Apply(sizes_and_dists);
+BENCHMARK_TEMPLATE(BM_Counter_increment, flat_counter64)
+        ->Apply(sizes_and_dists);
+
+template<class C>
+void BM_Counter_increment_many(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), int(state.range(1)));
+    C c;
+    for (auto _ : state) {
+        c.increment_many(keys);
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_label(state);
+}
+BENCHMARK_TEMPLATE(BM_Counter_increment_many, flat_counter64)
+        ->Apply(sizes_and_dists);
+
+// Batch sizes of batched_lookup, on 64K uniform keys per batch call.
+template<size_t Batch>
+void BM_batched_lookup(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), uniform);
+    flat_counter64 c;
+    c.update(keys);
+    size_t n = std::min<size_t>(keys.size(), 65536);
+    std::vector<uint64_t> probe(keys.begin(), keys.begin() + n);
+    for (auto _ : state) {
+        batched_lookup<Batch>(static_cast<const flat_map<uint64_t, int>&>(c),
+                              probe.begin(), probe.end(),
+                              [&c](size_t h, uint64_t k) {
+                                  ++c.try_emplace_hashed(h, k).first->second;
+                              });
+    }
+    state.SetItemsProcessed(state.iterations() * probe.size());
+}
+BENCHMARK_TEMPLATE(BM_batched_lookup, 1)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_batched_lookup, 4)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_batched_lookup, 16)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_batched_lookup, 64)->Apply(sizes);
+
+template<class C>
+void BM_Counter_most_common(benchmark::State& state) {
+    C c;
+    c.update(make_keys(state.range(0), int(state.range(1))));
+    typename C::item_vector v;
+    for (auto _ : state) {
+        c.most_common(v, 10);
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.SetItemsProcessed(state.iterations() * c.size());
+    set_label(state);
+}
+BENCHMARK_TEMPLATE(BM_Counter_most_common, std_counter)
+        ->Apply(sizes_and_dists);
+BENCHMARK_TEMPLATE(BM_Counter_most_common, flat_counter64)
+        ->Apply(sizes_and_dists);
+
+template<class C>
+void BM_Counter_most_common_all(benchmark::State& state) {
+    C c;
+    c.update(make_keys(state.range(0), uniform));
+    typename C::item_vector v;
+    for (auto _ : state) {
+        c.most_common(v);
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.SetItemsProcessed(state.iterations() * c.size());
+}
+BENCHMARK_TEMPLATE(BM_Counter_most_common_all, flat_counter64)->Apply(sizes);
+
+template<class C>
+void BM_Counter_elements(benchmark::State& state) {
+    C c;
+    c.update(make_keys(state.range(0), int(state.range(1))));
+    for (auto _ : state) {
+        uint64_t x = 0;
+        for (uint64_t k : c.elements()) x ^= k;
+        benchmark::DoNotOptimize(x);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    set_label(state);
+}
+BENCHMARK_TEMPLATE(BM_Counter_elements, std_counter)->Apply(sizes_and_dists);
+BENCHMARK_TEMPLATE(BM_Counter_elements, flat_counter64)
+        ->Apply(sizes_and_dists);
+
+template<class C>
+void BM_Counter_total(benchmark::State& state) {
+    C c;
+    c.update(make_keys(state.range(0), uniform));
+    for (auto _ : state) benchmark::DoNotOptimize(c.total());
+    state.SetItemsProcessed(state.iterations() * c.size());
+}
+BENCHMARK_TEMPLATE(BM_Counter_total, std_counter)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_Counter_total, flat_counter64)->Apply(sizes);
+
+// c += d, with d over the same universe of keys.
+template<class C>
+void BM_Counter_plus_assign(benchmark::State& state) {
+    C c, d;
+    c.update(make_keys(state.range(0), int(state.range(1)), 1));
+    d.update(make_keys(state.range(0), int(state.range(1)), 2));
+    for (auto _ : state) {
+        c += d;
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * d.size());
+    set_label(state);
+}
+BENCHMARK_TEMPLATE(BM_Counter_plus_assign, std_counter)
+        ->Apply(sizes_and_dists);
+BENCHMARK_TEMPLATE(BM_Counter_plus_assign, flat_counter64)
+        ->Apply(sizes_and_dists);
+
+typedef Counter<uint64_t, std::map<uint64_t, int>> sorted_counter;
+
+// c op= d over counters of the same n keys, d either a copy of c, which
+// for flat counters has the same layout, or built from the keys in another
+// order, selected by the second argument.
+template<class C, class Op>
+void set_op(benchmark::State& state, Op op) {
+    auto keys = distinct_keys(state.range(0));
+    C c, d;
+    for (uint64_t k : keys) c[k] = 2;
+    if (state.range(1)) {
+        d = c;
+    } else {
+        std::shuffle(keys.begin(), keys.end(), std::mt19937_64(4));
+        for (uint64_t k : keys) d[k] = 1;
+    }
+    for (auto _ : state) {
+        op(c, d);
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    state.SetLabel(state.range(1) ? "same layout" : "other layout");
+}
+
+template<class C>
+void BM_Counter_add(benchmark::State& state) {
+    set_op<C>(state, [](C& c, const C& d) { c += d; });
+}
+
+template<class C>
+void BM_Counter_or(benchmark::State& state) {
+    set_op<C>(state, [](C& c, const C& d) { c |= d; });
+}
+
+template<class C>
+void BM_Counter_and(benchmark::State& state) {
+    set_op<C>(state, [](C& c, const C& d) { c &= d; });
+}
+
+void sizes_and_layouts(benchmark::internal::Benchmark* b) {
+    for (int64_t n = 1000; n <= max_size(); n *= 10)
+        for (int same : {0, 1}) b->Args({n, same});
+}
+
+BENCHMARK_TEMPLATE(BM_Counter_add, flat_counter64)->Apply(sizes_and_layouts);
+BENCHMARK_TEMPLATE(BM_Counter_add, std_counter)->Apply(sizes_and_layouts);
+BENCHMARK_TEMPLATE(BM_Counter_add, sorted_counter)->Apply(sizes_and_layouts);
+BENCHMARK_TEMPLATE(BM_Counter_or, flat_counter64)->Apply(sizes_and_layouts);
+BENCHMARK_TEMPLATE(BM_Counter_and, flat_counter64)->Apply(sizes_and_layouts);
+BENCHMARK_TEMPLATE(BM_Counter_and, sorted_counter)->Apply(sizes_and_layouts);
+
+void threads_and_sizes(benchmark::internal::Benchmark* b) {
+    for (int64_t n = 100000; n <= max_size(); n *= 10)
+        for (int t : {1, 8, 32}) b->Args({n, t});
+}
+
+template<class C>
+void BM_Counter_from_parallel(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), zipf);
+    for (auto _ : state) {
+        C c = C::from_parallel(keys, unsigned(state.range(1)));
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK_TEMPLATE(BM_Counter_from_parallel, std_counter)
+        ->Apply(threads_and_sizes)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Counter_from_parallel, flat_counter64)
+        ->Apply(threads_and_sizes)->UseRealTime();
+
+template<class C>
+void BM_Counter_merge_parallel(benchmark::State& state) {
+    C c, d;
+    c.update(make_keys(state.range(0), uniform, 1));
+    d.update(make_keys(state.range(0), uniform, 2));
+    for (auto _ : state) {
+        c.merge_parallel(d, unsigned(state.range(1)));
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * d.size());
+}
+BENCHMARK_TEMPLATE(BM_Counter_merge_parallel, std_counter)
+        ->Apply(threads_and_sizes)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_Counter_merge_parallel, flat_counter64)
+        ->Apply(threads_and_sizes)->UseRealTime();
+
+// The deltas of 64 nodes, each touching n / 64 keys of a shared universe,
+// summed on as many threads.
+void BM_Counter_merge_tree(benchmark::State& state) {
+    std::vector<flat_counter64> parts(64);
+    for (size_t i = 0; i < parts.size(); ++i)
+        parts[i].update(make_keys(state.range(0) / 64, uniform, i + 1));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto v = parts;
+        state.ResumeTiming();
+        auto c = flat_counter64::merge_tree(std::move(v),
+                                            unsigned(state.range(1)));
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Counter_merge_tree)->Apply(threads_and_sizes)->UseRealTime();
+
+// One interval of a node counting n keys, 1% of which it touches again,
+// shipping all of its counts with dump or only the changes since its last
+// checkpoint, as the bytes counter shows.
+template<bool Delta>
+void BM_ship_interval(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), uniform);
+    auto churn = make_keys(state.range(0) / 100, uniform, 2);
+    delta_counter<uint64_t, flat_map64> c;
+    c.update(keys.begin(), keys.end());
+    c.checkpoint();
+    std::ostringstream os;
+    for (auto _ : state) {
+        c.update(churn.begin(), churn.end());
+        os.str("");
+        if (Delta) dump(os, c.checkpoint());
+        else dump(os, c.counts());
+    }
+    state.counters["bytes"] = double(os.tellp());
+    state.SetItemsProcessed(state.iterations() * churn.size());
+}
+BENCHMARK_TEMPLATE(BM_ship_interval, false)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ship_interval, true)->Apply(sizes);
+
+// Token ingestion from memory, into a transparent string_counter and a
+// plain Counter of std::string.
+template<class C>
+void BM_Counter_update_tokens(benchmark::State& state) {
+    std::string text;
+    for (uint64_t k : make_keys(state.range(0), zipf))
+        text += std::to_string(k % 100000) + ' ';
+    for (auto _ : state) {
+        C c;
+        c.update_tokens(text);
+        benchmark::DoNotOptimize(c.size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK_TEMPLATE(BM_Counter_update_tokens, string_counter<>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_Counter_update_tokens, Counter<std::string>)
+        ->Apply(sizes);
+
+//-----ranked_counter, concurrent_counter, epoch_counter, approx_counter-----
+// The cost of keeping the entries ranked, against a plain Counter.
+template<class C>
+void BM_ranked_increment(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), int(state.range(1)));
+    C c;
+    for (auto _ : state) {
+        for (uint64_t k : keys) ++c[k];
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_label(state);
+}
+BENCHMARK_TEMPLATE(BM_ranked_increment, std_counter)->Apply(sizes_and_dists);
+BENCHMARK_TEMPLATE(BM_ranked_increment, ranked_counter<uint64_t>)
+        ->Apply(sizes_and_dists);
+
+void BM_ranked_most_common(benchmark::State& state) {
+    ranked_counter<uint64_t> c;
+    for (uint64_t k : make_keys(state.range(0), zipf)) ++c[k];
+    std::vector<std::pair<uint64_t, int>> v;
+    for (auto _ : state) {
+        c.most_common(v, 10);
+        benchmark::DoNotOptimize(v.data());
+    }
+    state.SetItemsProcessed(state.iterations() * 10);
+}
+BENCHMARK(BM_ranked_most_common)->Apply(sizes);
+
+// Threads incrementing one shared counter, on Zipfian keys.
+template<class Map>
+void BM_concurrent_increment(benchmark::State& state) {
+    static concurrent_counter<uint64_t, Map>* c;
+    static std::vector<uint64_t> keys;
+    if (state.thread_index() == 0) {
+        c = new concurrent_counter<uint64_t, Map>(256);
+        keys = make_keys(1000000, zipf);
+    }
+    size_t i = size_t(state.thread_index()) * 7919;
+    for (auto _ : state) {
+        c->increment(keys[i % keys.size()]);
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) delete c;
+}
+BENCHMARK_TEMPLATE(BM_concurrent_increment, std_map)
+        ->Threads(1)->Threads(8)->Threads(32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_concurrent_increment, flat_map64)
+        ->Threads(1)->Threads(8)->Threads(32)->UseRealTime();
+
+// The same, with thread 0 also reading every count every 64K increments:
+// concurrent_counter copies them shard by shard under their locks, while
+// epoch_counter publishes the shards written to and reads the snapshot.
+template<class T, class Map>
+size_t read_counts(concurrent_counter<T, Map>& c) {
+    return c.snapshot().size();
+}
+template<class T, class Map>
+size_t read_counts(epoch_counter<T, Map>& c) { return c.publish()->size(); }
+
+template<class C>
+void BM_increment_while_reading(benchmark::State& state) {
+    static C* c;
+    static std::vector<uint64_t> keys;
+    if (state.thread_index() == 0) {
+        c = new C(256);
+        keys = make_keys(1000000, zipf);
+    }
+    size_t i = size_t(state.thread_index()) * 7919;
+    for (auto _ : state) {
+        c->increment(keys[i % keys.size()]);
+        if (state.thread_index() == 0 && i % 65536 == 0)
+            benchmark::DoNotOptimize(read_counts(*c));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) delete c;
+}
+BENCHMARK_TEMPLATE(BM_increment_while_reading,
+                   concurrent_counter<uint64_t, flat_map64>)
+        ->Threads(1)->Threads(8)->Threads(32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_increment_while_reading,
+                   epoch_counter<uint64_t, flat_map64>)
+        ->Threads(1)->Threads(8)->Threads(32)->UseRealTime();
+
+void BM_approx_increment(benchmark::State& state) {
+    auto keys = make_keys(state.range(0), int(state.range(1)));
+    approx_counter<uint64_t> c;
+    for (auto _ : state) {
+        for (uint64_t k : keys) c.increment(k);
+        benchmark::DoNotOptimize(c.total());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_label(state);
+}
+BENCHMARK(BM_approx_increment)->Apply(sizes_and_dists);
+
+//-----Frozen maps-----
+// Lookups of present keys in maps built from the same n keys, mutable and
+// frozen with freeze.
+template<class Map>
+void BM_frozen_find(benchmark::State& state) {
+    auto keys = distinct_keys(state.range(0));
+    std_map src;
+    for (uint64_t k : keys) src[k] = 1;
+    Map m(src.begin(), src.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(3));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(m.find(keys[i]));
+        if (++i == keys.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_frozen_find, std_map)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen_find, flat_map64)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen_find, frozen_map<uint64_t, int>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen_find, std::map<uint64_t, int>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_frozen_find, eytzinger_map<uint64_t, int>)
+        ->Apply(sizes);
+
+template<class Map>
+void BM_freeze(benchmark::State& state) {
+    Map m;
+    for (uint64_t k : distinct_keys(state.range(0))) m[k] = 1;
+    for (auto _ : state) benchmark::DoNotOptimize(freeze(m).size());
+    state.SetItemsProcessed(state.iterations() * m.size());
+}
+BENCHMARK_TEMPLATE(BM_freeze, std_map)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_freeze, std::map<uint64_t, int>)->Apply(sizes);
+
+//-----ChainMap-----
+template<class T, size_t>
+using repeat = T;
+
+template<class Map, size_t... I>
+ChainMap<repeat<Map, I>...> make_chain(std::vector<Map>& ms,
+                                       std::index_sequence<I...>) {
+    return ChainMap<repeat<Map, I>...>(ms[I]...);
+}
+
+// depth maps sharing n keys round robin, so that a lookup walks half of
+// the chain on average.
+template<class Map>
+std::vector<Map> chain_levels(size_t depth, const std::vector<uint64_t>& keys) {
+    std::vector<Map> ms(depth);
+    for (size_t i = 0; i < keys.size(); ++i) ms[i % depth][keys[i]] = int(i);
+    return ms;
+}
+
+template<class Map, size_t Depth>
+void BM_ChainMap_at(benchmark::State& state) {
+    auto keys = distinct_keys(state.range(0));
+    auto ms = chain_levels<Map>(Depth, keys);
+    auto cm = make_chain(ms, std::make_index_sequence<Depth>());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(3));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cm.at(keys[i]));
+        if (++i == keys.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_ChainMap_at, std_map, 1)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ChainMap_at, std_map, 2)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ChainMap_at, std_map, 4)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ChainMap_at, std_map, 8)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ChainMap_at, flat_map64, 4)->Apply(sizes);
+
+// operator[] on a fresh chain: keys of later maps are copied into the first.
+template<class Map, size_t Depth>
+void BM_ChainMap_subscript(benchmark::State& state) {
+    auto keys = distinct_keys(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto ms = chain_levels<Map>(Depth, keys);
+        auto cm = make_chain(ms, std::make_index_sequence<Depth>());
+        state.ResumeTiming();
+        for (uint64_t k : keys) benchmark::DoNotOptimize(++cm[k]);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK_TEMPLATE(BM_ChainMap_subscript, std_map, 1)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ChainMap_subscript, std_map, 4)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ChainMap_subscript, std_map, 8)->Apply(sizes);
+
+template<class Map, size_t Depth>
+void BM_ChainMap_one_map(benchmark::State& state) {
+    auto keys = distinct_keys(state.range(0));
+    auto ms = chain_levels<Map>(Depth, keys);
+    auto cm = make_chain(ms, std::make_index_sequence<Depth>());
+    for (auto _ : state) benchmark::DoNotOptimize(cm.one_map().size());
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK_TEMPLATE(BM_ChainMap_one_map, std_map, 1)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ChainMap_one_map, std_map, 4)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_ChainMap_one_map, std_map, 8)->Apply(sizes);
+
+// Misses in a dynamic_chainmap, with and without Bloom filters, at depths
+// given by the second argument.
+template<class Filter>
+void BM_dynamic_chainmap_miss(benchmark::State& state) {
+    auto keys = distinct_keys(state.range(0));
+    auto ms = chain_levels<std_map>(size_t(state.range(1)), keys);
+    dynamic_chainmap<std_map, Filter> d;
+    for (auto &m : ms) d.push_child(m);
+    auto probe = make_keys(keys.size(), uniform, 5);
+    for (auto &k : probe) k = ~k;
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(d.find(probe[i]));
+        if (++i == probe.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void sizes_and_depths(benchmark::internal::Benchmark* b) {
+    for (int64_t n = 1000; n <= max_size(); n *= 10)
+        for (int d : {1, 4, 16}) b->Args({n, d});
+}
+BENCHMARK_TEMPLATE(BM_dynamic_chainmap_miss, no_filter)
+        ->Apply(sizes_and_depths);
+BENCHMARK_TEMPLATE(BM_dynamic_chainmap_miss, bloom_filter<uint64_t>)
+        ->Apply(sizes_and_depths);
+
+}
+
+BENCHMARK_MAIN();
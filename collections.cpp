@@ -2,222 +2,4235 @@
  * C++ implementation of Python collections
  *
  * defaultdict(f[, initializer_list]) behaves as expected, f supplying the
- * default value, with the signature of V (*)().
+ * default value. f is a V (*)() unless the fourth template parameter names
+ * another callable, such as a lambda with state, which may also take the
+ * missing key. make_defaultdict<K>(f) deduces the value and factory types.
+ * A missing key is looked up once and its default value is built in place,
+ * without exceptions.
+ *   - try_emplace(k[, args...]) Insert a value built from args, or from f
+ *   when args is empty, unless k is already present.
+ *   - try_emplace_hashed(hash, k[, args...]) Same as try_emplace, with the
+ *   hash of k computed by the caller.
+ *   - get_many(keys, out) Write a pointer to the value of each key, as given
+ *   by operator[], to the output iterator out. keys is read twice, so it
+ *   must be a forward range. In a flat_map the keys are hashed and their
+ *   slots prefetched a batch at a time.
  *
  * Counter([initializer_list]) is like a defaultdict with a default value of
  * 0, additionally paired with the following methods:
  *   - elements() Return a range over elements repeating each as many times
  *   as its count. If an element’s count is less than one, elements() will
  *   ignore it.
+ *   - runs() Return a range over the (element, count) pairs that elements()
+ *   expands, those with a positive count.
+ *   - expand_into(out) Write the elements of elements() to the output
+ *   iterator out, filling a run at a time, and return the end of the output.
+ *   Given a std::span, in C++20, check that it is large enough and return
+ *   the part written.
  *   - most_common([n]) Return a vector of the n most common elements and their
  *   counts from the most common to the least. If n is omitted, most_common()
  *   returns all elements in the counter.
+ *   - most_common(v[, n]) Same as most_common([n]), storing the result in the
+ *   vector v so that its storage can be reused across calls.
  *   - update(initializer_list<key_type>) Count the elements in the list and
  *   update the counter accordingly.
- *   - +/-/+=/-= operators behave as expected.
+ *   - update(first, last), update(range) Same as update(initializer_list),
+ *   reserving room for up to 64K new keys first when the input is sized,
+ *   and counting a run of equal adjacent elements with a single lookup.
+ *   - +/-/+=/-= operators behave as expected, keeping the counts that end
+ *   up at zero or below, unlike Python.
+ *   - subtract(counter), subtract(first, last), subtract(initializer_list)
+ *   Subtract the counts of another counter, or one for each element, keeping
+ *   non-positive counts. add(counter, nonpositive::erase) and
+ *   subtract(counter, nonpositive::erase) drop them instead.
+ *   - &/|/&=/|= operators Keep the minimum and the maximum of the counts of
+ *   each key, and unary +/- the positive and the negated negative counts, all
+ *   only the positive results, as in Python. prune() erases the rest.
+ *   Two flat_map counters are combined slot by slot where their layouts
+ *   match, as for copies of one another, without hashing their keys, and
+ *   ordered ones merged in key order.
+ *   - from_parallel(range[, threads]) Count a random access range on several
+ *   threads and merge the partial counters pairwise in parallel.
+ *   - merge_tree(counters[, threads]) Sum a vector of counters, such as the
+ *   deltas of many nodes, pairwise in parallel.
+ *   - merge_parallel(counter[, threads]) Same as +=, updating existing keys
+ *   on several threads, or on one when the map keeps lookup_stats.
+ *   - increment_many(keys) Add one to the count of each key, looked up in
+ *   prefetched batches as in defaultdict::get_many.
+ *   - update_tokens(text[, seps]) Count the tokens of a std::string_view,
+ *   separated by any of the characters in seps, whitespace by default.
+ *   - ingest(istream[, chunk, seps]), ingest(fd[, chunk, seps]) Same as
+ *   update_tokens on everything read from a stream or a file descriptor, a
+ *   chunk at a time.
  * 
+ * flat_map<K, V[, Hash, Eq]> is a drop-in for std::unordered_map backed by a
+ * single open addressing array, probed a group of slots at a time. Growing the
+ * table invalidates references into it. With a transparent Hash and Eq, such
+ * as string_hash and std::equal_to<>, find, count and at accept any type the
+ * keys compare with, and update_tokens and ingest look tokens up without
+ * building a key unless it is new.
+ *
+ * defaultdict, Counter, ChainMap and dynamic_chainmap look up keys of other
+ * types than key_type, such as std::string_view or const char* for strings,
+ * as they are when their maps are transparent: a key is then only built to
+ * be inserted. Otherwise a ChainMap converts the key once for all its maps.
+ *
+ * Counter and defaultdict take the underlying map as their last template
+ * parameter; flat_counter<T> and flat_defaultdict<K, V> store their entries
+ * in a flat_map. string_counter<> is a flat_counter of std::string with a
+ * transparent hash, for counting tokens.
+ *
+ * Counts have the mapped type of the map, int by default, and flat_counter
+ * and pmr::Counter take it as a second parameter: a narrow type such as
+ * uint8_t packs more entries in a cache line, saturating<U> for an unsigned U
+ * stops at its bounds instead of wrapping around, uint64_t or double suit
+ * long streams and weights. total() sums into long long, unsigned long long
+ * or double, whichever matches the count type.
+ *
+ * flat_map, defaultdict and dynamic_chainmap take a Stats policy as their last
+ * template parameter, no_stats by default, which records nothing at no cost.
+ * With lookup_stats they count the events of their hot paths, read back as
+ * a plain struct with stats() and cleared with reset_stats(): flat_map
+ * lookups and a histogram of their probe lengths, growth and rehashes,
+ * defaultdict lookups and the misses its factory served, and a histogram of
+ * the depths chain lookups stop at, with the misses and the maps skipped by
+ * filters. flat_counter<T, C, Stats> and flat_defaultdict<K, V, F, Stats>
+ * pass it on to their flat_map. ChainMap::find(k, stats) records the depth
+ * into any stats object.
+ *
+ * clock_map<K, V>(capacity) is a flat_map that holds at most capacity
+ * entries, evicting one by CLOCK on an insertion into a full map, with a
+ * referenced bit per slot kept next to the table. make_clock_defaultdict<K>
+ * (capacity, f) builds a clock_defaultdict<K, V, F>, a defaultdict over one
+ * that bounds a memoization cache and counts its hits, misses and evictions
+ * in lookup_stats. Its get_many evicts other keys than those of the batch,
+ * and throws std::length_error on batches of more keys than the capacity.
+ * concurrent_defaultdict<K, V, F>(capacity, f[, shards]) shares
+ * one between threads, striped over shards with a mutex each, through
+ * get(k), which returns a copy of the value, erase(k), size(), capacity()
+ * and stats().
+ *
+ * pmr::Counter, pmr::defaultdict, pmr::flat_map, pmr::flat_counter and
+ * pmr::flat_defaultdict take a std::pmr::memory_resource, used as well by the
+ * results of their operator+, operator- and most_common.
+ *
+ * ranked_counter([initializer_list]) is a Counter that keeps its entries
+ * sorted by count, so that most_common(n) takes O(n) and total() O(1).
+ * operator[] returns a reference object instead of int&, through which each
+ * ++ or -- of a count relinks the entry in O(1), and a change of d walks up
+ * to d distinct counts. Supports update, +=, -= and both most_common forms.
+ *
+ * concurrent_counter([shards]) is a thread safe Counter striped over shards
+ * with one mutex each. Provides increment(t[, n]), update(il) and
+ * update(first, last), += of any map of counts, count(t), size(), total(),
+ * most_common([n]) and snapshot(), which returns a plain Counter. Reads see
+ * each shard consistently but not the shards at the same instant. drain(f)
+ * empties it, calling f on the counts taken from each shard.
+ *
+ * epoch_counter([shards]) is a concurrent_counter whose readers see the counts
+ * as of the last publish(), through immutable snapshots. Writers call
+ * increment(t[, n]), update and +=, and only wait for publish() to swap out
+ * their shard. snapshot() returns a shared_ptr to the current snapshot in
+ * O(1), without waiting for writers, and a Counter to iterate or call
+ * most_common or elements on. publish() folds in the counts written since
+ * and returns the new snapshot, reusing the table of the one before it once
+ * its readers have released it. In C++20, co_await next_snapshot() suspends
+ * a coroutine until the next publish(), which resumes it with the snapshot.
+ *
+ * approx_counter([width, depth, capacity]) counts an unbounded stream in
+ * fixed memory, with a Count-Min Sketch for the counts and a table of the
+ * capacity most common keys. Provides increment(t[, n]), update, count(t),
+ * which may overestimate, most_common([n]), total() and += of another
+ * approx_counter of the same dimensions or of any map of counts.
+ *
+ * dump(os, map) writes a Counter, a defaultdict or any other map in a compact
+ * binary format, with the keys sorted and integer keys delta encoded, and
+ * load(is, map) reads it back. load_add(is, counter) adds the counts read to
+ * those of a counter. dump_mapped(os, counter) writes a fixed layout
+ * that mapped_counter<T[, C]>(path) maps into memory read only, serving
+ * at(t), count(t), most_common([n]), elements(), size() and total() in place.
+ *
+ * delta_counter() tracks the changes to its counts since the last
+ * checkpoint() alongside them, so that nodes ship deltas that grow with the
+ * keys they touched rather than with all of their keys. Provides
+ * increment(t[, n]), update, += of any map of counts, count(t), size(),
+ * counts(), changes() and checkpoint(), which returns the changes as a
+ * Counter, to be written with dump and added with load_add or +=.
+ *
  * ChainMap(map[, maps...]) Groups multiple mappings together to create a
  * single, updateable view. The following methods are supported. 
  *   - get_map(n) Return the n-th map, by reference.
  *   - new_child(map) Create a new ChainMap containing a new map followed by
  *   all of the maps in the current instance.
+ *   - find(k) const Return a pointer to the value associated with the given
+ *   key, or nullptr if no mapping has it. Read only. The maps are searched
+ *   in a sequence of finds expanded at compile time, a hit in the first one
+ *   taken as the likely case.
+ *   - level<I>() Return the I-th map, with I a constant.
  *   - at(k) const Search for the value associated with the given key. Throws
  *   exception on failure. Read only.
  *   - operator[k] Can read and write, but all modifications only apply to
- *   the first mapping.
+ *   the first mapping. A value found in a later mapping is copied into the
+ *   first one, since a reference to it may be written through.
+ *   - ref(k) Return a reference object to the value in the mapping that
+ *   holds it. It is read in place with get() and copied into the first
+ *   mapping only when written through mut() or =.
+ *   - emplace_front(k[, args...]) Insert a value built from args into the
+ *   first mapping unless k is already there, and return it.
  *   - one_map() Return a single materialized map containing all the keys
  *   and their values as if returned by at().
+ *   - begin(), end() Iterate over the same keys and values as one_map(),
+ *   without building it: each mapping in turn, skipping the keys found in
+ *   an earlier one.
+ *   - cached() Return a view with the same find, at, operator[], erase,
+ *   get_map and one_map, answering lookups from an index of the merged keys
+ *   built once. Writes through the view keep the index up to date, other
+ *   changes require a call to get_map(n) or invalidate() on the view.
+ *
+ * freeze(map) returns a read only copy of a Counter, defaultdict, std::map or
+ * any other map, for lookups that never change, such as the last maps of a
+ * ChainMap. A hashed map becomes a frozen_map, its entries packed in as
+ * many slots by a minimal perfect hash, so that a lookup reads one seed and
+ * compares one key. An ordered map becomes an eytzinger_map, sorted in the
+ * breadth first layout of a search tree that is searched without branches.
+ * Both provide find, count, at, size and iteration, in their layout order.
+ *
+ * make_const_table<K, V>({{k, v}, ...}) builds a const_table, a read only
+ * map whose entries are fixed at compile time, as static data sorted by key.
+ * Declared constexpr, its find, count and at work in constant expressions,
+ * and as the last map of a ChainMap it holds defaults at no run time cost.
+ *
+ * dynamic_chainmap(map[, maps...]) is a ChainMap over maps of a single type
+ * whose number changes at run time. Besides the ChainMap methods:
+ *   - push_child(map) Make map the first mapping.
+ *   - pop_child() Drop the first mapping.
+ *   - depth() Return the number of mappings.
+ * dynamic_chainmap<Map, bloom_filter<K>> also keeps a Bloom filter per
+ * mapping, so that lookups only probe the mappings that may hold the key.
+ *   - rebuild_filter(n), rebuild_filters() Bring the filter of the n-th
+ *   mapping, or of all of them, up to date after changes through get_map.
+ *
+ * CMakeLists.txt builds the smoke tests of main() as collections, run by
+ * ctest, and the Google Benchmark suite of bench.cpp as bench, which
+ * includes this file with COLLECTIONS_NO_MAIN defined.
  */
 
-#include <iostream>
-#include <vector>
-#include <map>
-#include <unordered_map>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <type_traits>
+#include <system_error>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// COLLECTIONS_LIKELY(x) tells the compiler that x is usually true, as a hit
+// in the first map of a chain, and COLLECTIONS_COLD marks a function as
+// rarely called.
+#ifdef __GNUC__
+#define COLLECTIONS_LIKELY(x) __builtin_expect(!!(x), 1)
+#define COLLECTIONS_COLD __attribute__((cold, noinline))
+#else
+#define COLLECTIONS_LIKELY(x) (x)
+#define COLLECTIONS_COLD
+#endif
+
+template<class Iter>
+struct range {
+    Iter b, e;
+    Iter begin() { return b; }
+    Iter end() { return e; }
+};
+
+template<class It>
+using is_forward_iterator = std::is_base_of<std::forward_iterator_tag,
+        typename std::iterator_traits<It>::iterator_category>;
+
+template<class It>
+using is_random_access_iterator = std::is_base_of<
+        std::random_access_iterator_tag,
+        typename std::iterator_traits<It>::iterator_category>;
+
+template<class R, class = void>
+struct is_sized_range : std::false_type {};
+
+template<class R>
+struct is_sized_range<R, std::void_t<decltype(std::size(std::declval<R&>()))>>
+        : std::true_type {};
+
+// Calls f(0), ..., f(n - 1) on n threads, the last one on the calling thread,
+// and rethrows the first exception thrown by any of them.
+template<class F>
+void parallel_for(unsigned n, F f) {
+    std::vector<std::thread> ts;
+    std::exception_ptr error;
+    std::mutex m;
+    auto run = [&](unsigned i) {
+        try { f(i); }
+        catch (...) {
+            std::lock_guard<std::mutex> l(m);
+            if (!error) error = std::current_exception();
+        }
+    };
+    ts.reserve(n ? n - 1 : 0);
+    for (unsigned i = 0; i + 1 < n; ++i) ts.emplace_back(run, i);
+    if (n) run(n - 1);
+    for (auto &t : ts) t.join();
+    if (error) std::rethrow_exception(error);
+}
+
+inline unsigned default_threads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//-----stats-----
+// Stats policy of flat_map, defaultdict and dynamic_chainmap that records
+// nothing. It is their default, and its hooks compile away.
+struct no_stats {
+    void probe(size_t) {}
+    void grow(size_t, size_t) {}
+    void dict_lookup(bool) {}
+    void chain_hit(size_t) {}
+    void chain_miss() {}
+    void filtered() {}
+    void evict() {}
+    no_stats& operator+=(const no_stats&) { return *this; }
+};
+
+// Stats policy counting what the hot paths do, to tune from data: probe
+// lengths show how well a flat_map's hash spreads, growth how much it should
+// have reserved, defaults the miss rate of a defaultdict, and the depth
+// histogram whether the maps of a chain come in the best order. Histograms
+// have a bucket per value below buckets - 1, and a last one for the rest.
+// Lookups record their stats even through const methods, so a container
+// keeping stats cannot be read from several threads at once.
+struct lookup_stats {
+    static constexpr size_t buckets = 16;
+
+    // flat_map lookups, the groups they probed, and how many probed 1, 2, ...
+    // groups, an empty table none.
+    uint64_t lookups = 0, probed = 0, probes[buckets] = {};
+    // Times a flat_map moved to a larger table or rehashed in place to clear
+    // deleted slots, and its current capacity.
+    uint64_t grows = 0, rehashes = 0, capacity = 0;
+    // defaultdict lookups and the values the factory made for missing keys.
+    uint64_t dict_lookups = 0, defaults = 0;
+    // Entries a clock_map evicted to make room for new ones.
+    uint64_t evictions = 0;
+    // Chain lookups found in the first, second, ... map or not at all, and
+    // maps skipped by a filter.
+    uint64_t depth[buckets] = {}, chain_misses = 0, filtered_maps = 0;
+
+    void probe(size_t groups) {
+        ++lookups, probed += groups;
+        if (groups) ++probes[std::min(groups, buckets) - 1];
+    }
+    void grow(size_t from, size_t to) {
+        if (from) ++(from == to ? rehashes : grows);
+        capacity = to;
+    }
+    void dict_lookup(bool missed) { ++dict_lookups, defaults += missed; }
+    void chain_hit(size_t level) { ++depth[std::min(level, buckets - 1)]; }
+    void chain_miss() { ++chain_misses; }
+    void filtered() { ++filtered_maps; }
+    void evict() { ++evictions; }
+
+    double mean_probe() const { return lookups ? double(probed) / lookups : 0; }
+    double miss_rate() const {
+        return dict_lookups ? double(defaults) / dict_lookups : 0;
+    }
+
+    // Sums the stats of several containers, such as the shards of a table.
+    lookup_stats& operator+=(const lookup_stats& s) {
+        lookups += s.lookups, probed += s.probed;
+        grows += s.grows, rehashes += s.rehashes;
+        capacity = std::max(capacity, s.capacity);
+        dict_lookups += s.dict_lookups, defaults += s.defaults;
+        evictions += s.evictions;
+        chain_misses += s.chain_misses, filtered_maps += s.filtered_maps;
+        for (size_t i = 0; i < buckets; ++i)
+            probes[i] += s.probes[i], depth[i] += s.depth[i];
+        return *this;
+    }
+};
+
+// Whether M keeps stats of type S, as a flat_map with S as its Stats does.
+template<class M, class S, class = void>
+struct has_stats : std::false_type {};
+
+template<class M, class S>
+struct has_stats<M, S, std::enable_if_t<std::is_same<
+        decltype(std::declval<const M&>().stats()), S>::value>>
+    : std::true_type {};
+
+//-----flat_map-----
+// Control bytes of an open addressing table: a full slot holds the low 7 bits
+// of its hash, empty and deleted slots have the high bit set. A group of
+// control bytes is matched at once, with SSE2 where available.
+struct flat_group {
+    static constexpr signed char empty = -128, deleted = -2, sentinel = 0;
+#ifdef __SSE2__
+    static constexpr size_t width = 16;
+    typedef unsigned mask;
+
+    __m128i ctrl;
+
+    explicit flat_group(const signed char* p) :
+            ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+
+    mask match(signed char h2) const {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+    }
+    mask match_empty() const { return match(empty); }
+    mask match_free() const { return _mm_movemask_epi8(ctrl); }
+    mask match_full() const { return match_free() ^ 0xffff; }
+
+    static size_t index(mask m) { return __builtin_ctz(m); }
+#else
+    static constexpr size_t width = 8;
+    typedef uint64_t mask;
+    static constexpr uint64_t lsbs = 0x0101010101010101ULL,
+                              msbs = 0x8080808080808080ULL;
+
+    uint64_t ctrl;
+
+    explicit flat_group(const signed char* p) { std::memcpy(&ctrl, p, 8); }
+
+    // May report false positives next to a true match, never false negatives.
+    mask match(signed char h2) const {
+        uint64_t x = ctrl ^ (lsbs * static_cast<unsigned char>(h2));
+        return (x - lsbs) & ~x & msbs;
+    }
+    mask match_empty() const { return ctrl & ~(ctrl << 6) & msbs; }
+    mask match_free() const { return ctrl & msbs; }
+    mask match_full() const { return ~ctrl & msbs; }
+
+    static size_t index(mask m) {
+        size_t i = 0;
+        while (!(m & 0x80)) m >>= 8, ++i;
+        return i;
+    }
+#endif
+};
+
+// Hash map with the interface of std::unordered_map, storing its values in
+// one flat array probed group by group. Capacity is a power of two number of
+// groups and at most 7/8 of the slots are used. References are invalidated
+// whenever the table grows. Like the standard containers, the allocator is
+// kept on copy and move assignment. With lookup_stats as Stats, the table
+// counts its lookups, their probe lengths and its growth.
+template<class K, class V, class Hash = std::hash<K>,
+         class Eq = std::equal_to<K>,
+         class Alloc = std::allocator<std::pair<const K, V>>,
+         class Stats = no_stats>
+struct flat_map {
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef Hash hasher;
+    typedef Eq key_equal;
+    typedef Alloc allocator_type;
+    typedef size_t size_type;
+
+    static constexpr size_t W = flat_group::width, npos = size_t(-1);
+
+    template<bool Const>
+    struct iter {
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const K, V> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::conditional_t<Const, const value_type, value_type>*
+                pointer;
+        typedef std::conditional_t<Const, const value_type, value_type>&
+                reference;
+
+        const signed char* ctrl = nullptr;
+        pointer slot = nullptr;
+
+        iter() = default;
+        iter(const signed char* c, pointer s) : ctrl(c), slot(s) {
+            while (*ctrl < 0) ++ctrl, ++slot;
+        }
+        template<bool C = Const, class = std::enable_if_t<!C>>
+        operator iter<true>() const { return {ctrl, slot}; }
+
+        reference operator*() const { return *slot; }
+        pointer operator->() const { return slot; }
+        iter& operator++() {
+            do ++ctrl, ++slot; while (*ctrl < 0);
+            return *this;
+        }
+        iter operator++(int) {
+            iter i = *this;
+            ++*this;
+            return i;
+        }
+        friend bool operator==(const iter& l, const iter& r) {
+            return l.ctrl == r.ctrl;
+        }
+        friend bool operator!=(const iter& l, const iter& r) {
+            return l.ctrl != r.ctrl;
+        }
+    };
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+    flat_map() : flat_map(0) {}
+    explicit flat_map(size_t n, const Hash& hash = Hash(), const Eq& eq = Eq(),
+                      const Alloc& a = Alloc()) :
+            hash_(hash), eq_(eq), alloc_(a) {
+        reserve(n);
+    }
+    explicit flat_map(const Alloc& a) : flat_map(0, Hash(), Eq(), a) {}
+    template<class It>
+    flat_map(It first, It last, const Alloc& a = Alloc()) : flat_map(a) {
+        insert(first, last);
+    }
+    flat_map(std::initializer_list<value_type> il, const Alloc& a = Alloc()) :
+            flat_map(il.begin(), il.end(), a) {}
+
+    // The copy keeps the slot layout of the original, deleted slots
+    // included, as probes for the keys past them must not stop there.
+    flat_map(const flat_map& m, const Alloc& a) :
+            flat_map(0, m.hash_, m.eq_, a) {
+        if (!m.size_) return;
+        allocate(m.cap_);
+        for (size_t i = 0; i < cap_; ++i) {
+            if (m.ctrl_[i] == flat_group::deleted)
+                ctrl_[i] = flat_group::deleted;
+            if (m.ctrl_[i] < 0) continue;
+            slot_traits::construct(alloc_, slots_ + i, m.slots_[i]);
+            ctrl_[i] = m.ctrl_[i];
+            ++size_;
+        }
+        growth_left_ = m.growth_left_;
+    }
+    flat_map(const flat_map& m) : flat_map(m,
+            slot_traits::select_on_container_copy_construction(m.alloc_)) {}
+    flat_map(flat_map&& m) noexcept :
+            hash_(m.hash_), eq_(m.eq_), alloc_(m.alloc_) {
+        swap_table(m);
+    }
+    flat_map(flat_map&& m, const Alloc& a) : flat_map(0, m.hash_, m.eq_, a) {
+        if (alloc_ == m.alloc_) swap_table(m);
+        else insert(std::make_move_iterator(m.begin()),
+                    std::make_move_iterator(m.end()));
+    }
+    ~flat_map() { release(); }
+
+    flat_map& operator=(const flat_map& m) {
+        if (this == &m) return *this;
+        flat_map t(m, alloc_);
+        swap_table(t);
+        hash_ = m.hash_, eq_ = m.eq_;
+        return *this;
+    }
+    flat_map& operator=(flat_map&& m) {
+        flat_map t(std::move(m), alloc_);
+        swap_table(t);
+        hash_ = t.hash_, eq_ = t.eq_;
+        return *this;
+    }
+
+    // As for the standard containers, the allocators must compare equal.
+    void swap(flat_map& m) noexcept {
+        swap_table(m);
+        std::swap(hash_, m.hash_), std::swap(eq_, m.eq_);
+        if constexpr (slot_traits::propagate_on_container_swap::value)
+            std::swap(alloc_, m.alloc_);
+    }
+
+    allocator_type get_allocator() const { return alloc_; }
+
+    iterator begin() { return {ctrl_, slots_}; }
+    iterator end() { return {ctrl_ + cap_, slots_ + cap_}; }
+    const_iterator begin() const { return {ctrl_, slots_}; }
+    const_iterator end() const { return {ctrl_ + cap_, slots_ + cap_}; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return !size_; }
+    size_t bucket_count() const { return cap_; }
+
+    // The slot of the entry at it, and the first entry in slot i or after,
+    // to walk the table from a position kept across insertions.
+    size_t slot_of(const_iterator it) const { return size_t(it.slot - slots_); }
+    iterator from_slot(size_t i) {
+        return i < cap_ ? iterator(ctrl_ + i, slots_ + i) : end();
+    }
+    float load_factor() const { return cap_ ? float(size_) / cap_ : 0; }
+    hasher hash_function() const { return hash_; }
+    key_equal key_eq() const { return eq_; }
+
+    Stats stats() const { return stats_; }
+    void reset_stats() { stats_ = Stats(); }
+
+    // The hash used to place k, mixed so that weak hashes such as the
+    // identity std::hash of integers still spread over the groups.
+    template<class Q>
+    size_t hash(const Q& k) const {
+        uint64_t h = hash_(k);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        return static_cast<size_t>(h ^ (h >> 33));
+    }
+
+    // Brings the group that a probe for the hash h starts at into the cache,
+    // ahead of a lookup of h.
+    void prefetch(size_t h) const {
+        if (!cap_) return;
+        size_t g = (h >> 7) & (cap_ / W - 1);
+#ifdef __GNUC__
+        __builtin_prefetch(ctrl_ + g * W);
+        __builtin_prefetch(slots_ + g * W);
+#else
+        (void)g;
+#endif
+    }
+
+    // Calls f(e, me) on the entries e of this table and me of m that hold
+    // the same key in the same slot, and f(e, nullptr) and f(nullptr, me) on
+    // the others, so on every entry of both tables once. The tables are
+    // compared and walked side by side a block of slots at a time, without
+    // hashing: m matches in full when it is a copy of this table, or got the
+    // same keys in the same order from the same capacity. f must not insert
+    // or erase.
+    template<class F>
+    void zip(const flat_map& m, F f) {
+        constexpr size_t block = 64 * W;
+        auto rest = [&](size_t b, size_t e) {
+            for_each_slot(b, e, [&](size_t i) { f(slots_ + i, nullptr); });
+            m.for_each_slot(b, e, [&](size_t i) { f(nullptr, m.slots_ + i); });
+        };
+        if (cap_ != m.cap_) {
+            rest(0, std::max(cap_, m.cap_));
+            return;
+        }
+        for (size_t b = 0; b < cap_; b += block) {
+            size_t e = std::min(cap_, b + block);
+            bool same = !std::memcmp(ctrl_ + b, m.ctrl_ + b, e - b);
+            if (same) {
+                for_each_slot(b, e, [&](size_t i) {
+                    same &= eq_(slots_[i].first, m.slots_[i].first);
+                });
+            }
+            if (same)
+                for_each_slot(b, e, [&](size_t i) {
+                    f(slots_ + i, m.slots_ + i);
+                });
+            else
+                rest(b, e);
+        }
+    }
+
+    // Afterwards n - size() keys can be inserted without a rehash. Deleted
+    // slots count against that, so a table short of room because of them is
+    // rehashed in place.
+    void reserve(size_t n) {
+        size_t cap = W;
+        while (growth(cap) < n) {
+            if (cap > std::numeric_limits<size_t>::max() / 2 /
+                      sizeof(value_type))
+                throw std::length_error("flat_map::reserve");
+            cap *= 2;
+        }
+        if (n && cap > cap_) rehash_to(cap);
+        else if (n > size_ && growth_left_ < n - size_) rehash_to(cap_);
+    }
+
+    void clear() {
+        for (size_t i = 0; i < cap_; ++i)
+            if (ctrl_[i] >= 0) slot_traits::destroy(alloc_, slots_ + i);
+        if (cap_) std::memset(ctrl_, flat_group::empty, cap_);
+        size_ = 0;
+        growth_left_ = growth(cap_);
+    }
+
+    iterator find(const K& k) { return find(k, hash(k)); }
+    const_iterator find(const K& k) const { return find(k, hash(k)); }
+    iterator find(const K& k, size_t h) { return at_index(find_index(k, h)); }
+    const_iterator find(const K& k, size_t h) const {
+        return at_index(find_index(k, h));
+    }
+
+    size_t count(const K& k) const { return find_index(k, hash(k)) != npos; }
+
+    // With a transparent Hash and Eq, keys are also looked up as any type
+    // they hash and compare with, such as std::string_view for std::string.
+    template<class Q, class H = Hash, class E = Eq,
+             class = typename H::is_transparent,
+             class = typename E::is_transparent>
+    iterator find(const Q& k) { return at_index(find_index(k, hash(k))); }
+    template<class Q, class H = Hash, class E = Eq,
+             class = typename H::is_transparent,
+             class = typename E::is_transparent>
+    const_iterator find(const Q& k) const {
+        return at_index(find_index(k, hash(k)));
+    }
+    template<class Q, class H = Hash, class E = Eq,
+             class = typename H::is_transparent,
+             class = typename E::is_transparent>
+    size_t count(const Q& k) const { return find_index(k, hash(k)) != npos; }
+    template<class Q, class H = Hash, class E = Eq,
+             class = typename H::is_transparent,
+             class = typename E::is_transparent>
+    const V& at(const Q& k) const {
+        size_t i = find_index(k, hash(k));
+        if (i == npos) throw std::out_of_range("flat_map::at: key not found");
+        return slots_[i].second;
+    }
+
+    V& at(const K& k) {
+        size_t i = find_index(k, hash(k));
+        if (i == npos) throw std::out_of_range("flat_map::at: key not found");
+        return slots_[i].second;
+    }
+    const V& at(const K& k) const {
+        return const_cast<flat_map*>(this)->at(k);
+    }
+
+    V& operator[](const K& k) { return try_emplace(k).first->second; }
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(const K& k, Args&&... args) {
+        return try_emplace_hashed(hash(k), k, std::forward<Args>(args)...);
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(K&& k, Args&&... args) {
+        size_t h = hash(k);
+        return try_emplace_hashed(h, std::move(k), std::forward<Args>(args)...);
+    }
+
+    // h must be hash(k).
+    template<class Q, class... Args>
+    std::pair<iterator, bool> try_emplace_hashed(size_t h, Q&& k,
+                                                 Args&&... args) {
+        size_t i = find_index(k, h);
+        if (i != npos) return {at_index(i), false};
+        i = prepare_insert(h);
+        slot_traits::construct(alloc_, slots_ + i, std::piecewise_construct,
+                               std::forward_as_tuple(std::forward<Q>(k)),
+                               std::forward_as_tuple(
+                                       std::forward<Args>(args)...));
+        commit(i, h);
+        return {at_index(i), true};
+    }
+
+    std::pair<iterator, bool> insert(const value_type& v) {
+        return try_emplace(v.first, v.second);
+    }
+    std::pair<iterator, bool> insert(value_type&& v) {
+        return try_emplace(v.first, std::move(v.second));
+    }
+    template<class It>
+    void insert(It first, It last) {
+        for (; first != last; ++first) insert(*first);
+    }
+    template<class... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        return insert(value_type(std::forward<Args>(args)...));
+    }
+
+    iterator erase(const_iterator it) {
+        size_t i = it.ctrl - ctrl_;
+        erase_index(i);
+        return {ctrl_ + i, slots_ + i};
+    }
+    iterator erase(iterator it) { return erase(const_iterator(it)); }
+    size_t erase(const K& k) {
+        size_t i = find_index(k, hash(k));
+        if (i == npos) return 0;
+        erase_index(i);
+        return 1;
+    }
+
+private:
+    typedef typename std::allocator_traits<Alloc>::template
+            rebind_traits<value_type>
+            slot_traits;
+    typedef typename slot_traits::allocator_type slot_alloc;
+    typedef typename std::allocator_traits<Alloc>::template
+            rebind_alloc<signed char> ctrl_alloc;
+
+    signed char* ctrl_ = empty_ctrl();
+    value_type* slots_ = nullptr;
+    size_t cap_ = 0, size_ = 0, growth_left_ = 0;
+    Hash hash_;
+    Eq eq_;
+    slot_alloc alloc_;
+    [[no_unique_address]] mutable Stats stats_;
+
+    // Iterators of an unallocated table start and stop at this byte.
+    static signed char* empty_ctrl() {
+        static signed char c = flat_group::sentinel;
+        return &c;
+    }
+
+    static size_t growth(size_t cap) { return cap - cap / 8; }
+
+    // Calls f on the index of every full slot of [b, e), at most the
+    // capacity, found a group at a time, as branching on each slot would
+    // guess wrong for every other one.
+    template<class F>
+    void for_each_slot(size_t b, size_t e, F f) const {
+        for (size_t g = b; g < std::min(e, cap_); g += W)
+            for (auto m = flat_group(ctrl_ + g).match_full(); m; m &= m - 1)
+                f(g + flat_group::index(m));
+    }
+
+    iterator at_index(size_t i) {
+        return i == npos ? end() : iterator(ctrl_ + i, slots_ + i);
+    }
+    const_iterator at_index(size_t i) const {
+        return i == npos ? end() : const_iterator(ctrl_ + i, slots_ + i);
+    }
+
+    // Groups are probed in triangular order, which visits every group of a
+    // power of two sized table. A group with an empty slot ends the probe.
+    template<class Q>
+    size_t find_index(const Q& k, size_t h) const {
+        if (!cap_) return stats_.probe(0), npos;
+        size_t mask = cap_ / W - 1, g = (h >> 7) & mask;
+        for (size_t step = 1;; g = (g + step++) & mask) {
+            flat_group grp(ctrl_ + g * W);
+            for (auto m = grp.match(h & 0x7f); m; m &= m - 1) {
+                size_t i = g * W + flat_group::index(m);
+                if (eq_(slots_[i].first, k)) return stats_.probe(step), i;
+            }
+            if (grp.match_empty()) return stats_.probe(step), npos;
+        }
+    }
+
+    size_t find_free(size_t h) const {
+        size_t mask = cap_ / W - 1, g = (h >> 7) & mask;
+        for (size_t step = 1;; g = (g + step++) & mask)
+            if (auto m = flat_group(ctrl_ + g * W).match_free())
+                return g * W + flat_group::index(m);
+    }
+
+    // Reusing a deleted slot does not use up growth, anything else may need
+    // the table to grow first, or to be rehashed in place if it is mostly
+    // tombstones.
+    size_t prepare_insert(size_t h) {
+        size_t i = cap_ ? find_free(h) : 0;
+        if (!growth_left_ && (!cap_ || ctrl_[i] != flat_group::deleted)) {
+            rehash_to(cap_ && size_ < growth(cap_) / 2 ? cap_ :
+                      std::max(cap_ * 2, W));
+            i = find_free(h);
+        }
+        return i;
+    }
+
+    void commit(size_t i, size_t h) {
+        growth_left_ -= ctrl_[i] == flat_group::empty;
+        ctrl_[i] = h & 0x7f;
+        ++size_;
+    }
+
+    // A slot can only go back to empty if its group still has an empty slot,
+    // as then no probe has ever passed over the group.
+    void erase_index(size_t i) {
+        slot_traits::destroy(alloc_, slots_ + i);
+        --size_;
+        if (flat_group(ctrl_ + i / W * W).match_empty()) {
+            ctrl_[i] = flat_group::empty;
+            ++growth_left_;
+        } else {
+            ctrl_[i] = flat_group::deleted;
+        }
+    }
+
+    void swap_table(flat_map& m) noexcept {
+        std::swap(ctrl_, m.ctrl_), std::swap(slots_, m.slots_);
+        std::swap(cap_, m.cap_), std::swap(size_, m.size_);
+        std::swap(growth_left_, m.growth_left_);
+    }
+
+    void allocate(size_t cap) {
+        ctrl_ = ctrl_alloc(alloc_).allocate(cap + 1);
+        std::memset(ctrl_, flat_group::empty, cap);
+        ctrl_[cap] = flat_group::sentinel;
+        try { slots_ = slot_traits::allocate(alloc_, cap); }
+        catch (...) {
+            ctrl_alloc(alloc_).deallocate(ctrl_, cap + 1);
+            ctrl_ = empty_ctrl();
+            throw;
+        }
+        cap_ = cap;
+        growth_left_ = growth(cap);
+    }
+
+    void release() {
+        if (!cap_) return;
+        for (size_t i = 0; i < cap_; ++i)
+            if (ctrl_[i] >= 0) slot_traits::destroy(alloc_, slots_ + i);
+        ctrl_alloc(alloc_).deallocate(ctrl_, cap_ + 1);
+        slot_traits::deallocate(alloc_, slots_, cap_);
+        ctrl_ = empty_ctrl(), slots_ = nullptr;
+        cap_ = size_ = growth_left_ = 0;
+    }
+
+    void rehash_to(size_t cap) {
+        stats_.grow(cap_, cap);
+        flat_map t(0, hash_, eq_, alloc_);
+        t.allocate(cap);
+        for (size_t i = 0; i < cap_; ++i) {
+            if (ctrl_[i] < 0) continue;
+            // The key is moved from, as its slot is destroyed along with the
+            // old table.
+            value_type& v = slots_[i];
+            size_t h = hash(v.first), j = t.find_free(h);
+            slot_traits::construct(t.alloc_, t.slots_ + j,
+                                   std::move(const_cast<K&>(v.first)),
+                                   std::move(v.second));
+            t.commit(j, h);
+        }
+        swap_table(t);
+    }
+};
+
+template<class M>
+struct is_flat_map : std::false_type {};
+
+template<class K, class V, class H, class E, class A, class S>
+struct is_flat_map<flat_map<K, V, H, E, A, S>> : std::true_type {};
+
+template<class K, class V, class Hash, class Eq>
+struct frozen_map;
+
+template<class M>
+struct is_frozen_map : std::false_type {};
+
+template<class K, class V, class H, class E>
+struct is_frozen_map<frozen_map<K, V, H, E>> : std::true_type {};
+
+template<class K, class V, class Hash, class Eq, class Alloc, class Stats>
+struct clock_map;
+
+template<class M>
+struct is_clock_map : std::false_type {};
+
+template<class K, class V, class H, class E, class A, class S>
+struct is_clock_map<clock_map<K, V, H, E, A, S>> : std::true_type {};
+
+#ifdef __cpp_lib_generic_unordered_lookup
+constexpr bool generic_unordered_lookup = true;
+#else
+constexpr bool generic_unordered_lookup = false;
+#endif
+
+template<class M, class = void>
+struct is_ordered_map : std::false_type {};
+
+template<class M>
+struct is_ordered_map<M, std::void_t<typename M::key_compare>>
+    : std::true_type {};
+
+// Whether M finds keys from other types than its key_type: ordered maps with
+// a transparent compare, flat_maps and frozen_maps with a transparent hash
+// and equality, and std::unordered_maps with both from C++20 on.
+template<class M, class = void>
+struct is_transparent_map : std::false_type {};
+
+template<class M>
+struct is_transparent_map<M, std::void_t<
+        typename M::key_compare::is_transparent>> : std::true_type {};
+
+template<class M>
+struct is_transparent_map<M, std::void_t<typename M::hasher::is_transparent,
+                                         typename M::key_equal::is_transparent>>
+    : std::bool_constant<is_flat_map<M>::value || is_frozen_map<M>::value ||
+                         generic_unordered_lookup> {};
+
+// Transparent hash of strings, std::string_view and C strings, to be paired
+// with std::equal_to<>.
+struct string_hash {
+    typedef void is_transparent;
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+template<class M, class = void>
+struct has_reserve : std::false_type {};
+
+template<class M>
+struct has_reserve<M, std::void_t<decltype(
+        std::declval<M&>().reserve(size_t()))>> : std::true_type {};
+
+// Makes room for n entries in m when it is a hash map. Ordered maps have no
+// room to make.
+template<class Map>
+void reserve_for(Map& m, size_t n) {
+    if constexpr (has_reserve<Map>::value) m.reserve(n);
+}
+
+// The equality of keys of m: its key_eq(), or for an ordered map the
+// equivalence under its key_comp().
+template<class Map>
+auto key_equivalence(const Map& m) {
+    if constexpr (is_ordered_map<Map>::value) {
+        auto c = m.key_comp();
+        return [c](const auto& l, const auto& r) {
+            return !c(l, r) && !c(r, l);
+        };
+    } else {
+        return m.key_eq();
+    }
+}
+
+// Same as m.try_emplace(k, args...) for a k of any type that m looks up,
+// where a key_type is only built from k when it is inserted.
+template<class Map, class Q, class... Args>
+std::pair<typename Map::iterator, bool> find_or_emplace(Map& m, const Q& k,
+                                                        Args&&... args) {
+    typedef typename Map::key_type K;
+    if constexpr (std::is_same<Q, K>::value) {
+        return m.try_emplace(k, std::forward<Args>(args)...);
+    } else if constexpr (is_flat_map<Map>::value &&
+                         is_transparent_map<Map>::value) {
+        return m.try_emplace_hashed(m.hash(k), k, std::forward<Args>(args)...);
+    } else {
+        if constexpr (is_transparent_map<Map>::value) {
+            auto i = m.find(k);
+            if (i != m.end()) return {i, false};
+        }
+        return m.try_emplace(K(k), std::forward<Args>(args)...);
+    }
+}
+
+// Calls f(h, k) on each key k of [first, last) in order, with h = m.hash(k)
+// if m is a flat_map. There keys are hashed and their groups prefetched a
+// Batch at a time before being handed to f, so that the cache misses of a
+// batch overlap instead of following one another. Other maps cannot be
+// prefetched into, and get h = 0.
+template<size_t Batch = 16, class Map, class It, class F>
+void batched_lookup(const Map& m, It first, It last, F f) {
+    if constexpr (is_flat_map<Map>::value) {
+        static_assert(is_forward_iterator<It>::value,
+                      "batched_lookup reads keys twice");
+        size_t h[Batch];
+        while (first != last) {
+            It b = first;
+            size_t n = 0;
+            for (; n < Batch && first != last; ++n, ++first) {
+                h[n] = m.hash(*first);
+                m.prefetch(h[n]);
+            }
+            for (size_t i = 0; i < n; ++i, ++b) f(h[i], *b);
+        }
+    } else {
+        for (; first != last; ++first) f(size_t(0), *first);
+    }
+}
+
+//-----defaultdict-----
+// The value a factory F builds for a key of type K: F may take the key or
+// nothing.
+template<class F, class K, class = void>
+struct factory_result {
+    typedef std::decay_t<std::invoke_result_t<F&>> type;
+};
+
+template<class F, class K>
+struct factory_result<F, K, std::enable_if_t<
+        std::is_invocable<F&, const K&>::value>> {
+    typedef std::decay_t<std::invoke_result_t<F&, const K&>> type;
+};
+
+// The factory is a template parameter, so a function object or lambda is
+// called directly, with its state kept in the defaultdict. With lookup_stats
+// as Stats, lookups through operator[], try_emplace(k) and get_many count
+// how often the factory was needed.
+template<class K, class V, class Map = std::unordered_map<K, V>,
+         class F = V (*)(), class Stats = no_stats>
+struct defaultdict : Map {
+    typedef Map M;
+    typedef typename M::iterator iterator;
+
+    F f;
+
+    // Converts to the value f makes for k on demand, so that try_emplace
+    // builds the default value in place and only when k is actually missing.
+    template<class Q>
+    struct lazy_default {
+        F* f;
+        const Q* k;
+        operator V() const {
+            if constexpr (std::is_invocable<F&, const Q&>::value)
+                return (*f)(*k);
+            else if constexpr (std::is_invocable<F&, const K&>::value)
+                return (*f)(K(*k));
+            else
+                return (*f)();
+        }
+    };
+
+    typedef typename M::allocator_type allocator_type;
+
+    template<class G = F, class = std::enable_if_t<
+            std::is_default_constructible<G>::value && std::is_class<G>::value>>
+    defaultdict() : f() {}
+    defaultdict(F f) : f(std::move(f)) {}
+    defaultdict(F f, std::initializer_list<std::pair<const K, V>> il) :
+            M(il), f(std::move(f)) {}
+    defaultdict(F f, const allocator_type& a) : M(a), f(std::move(f)) {}
+    // Starts from m, such as an empty clock_map of some capacity.
+    defaultdict(F f, M m) : M(std::move(m)), f(std::move(f)) {}
+    defaultdict(const defaultdict& d, const allocator_type& a) :
+            M(d, a), f(d.f) {}
+
+    V& operator[](const K& k) { return try_emplace(k).first->second; }
+
+    V& at(const K& k) { return (*this)[k]; }
+
+    // When M looks up other types than K, k is only converted to K on a miss.
+    template<class Q, class = std::enable_if_t<
+            is_transparent_map<M>::value && !std::is_same<Q, K>::value>>
+    V& operator[](const Q& k) {
+        auto i = find_or_emplace(static_cast<M&>(*this), k,
+                                 lazy_default<Q>{&f, &k});
+        stats_.dict_lookup(i.second);
+        return i.first->second;
+    }
+
+    template<class Q, class = std::enable_if_t<
+            is_transparent_map<M>::value && !std::is_same<Q, K>::value>>
+    V& at(const Q& k) { return (*this)[k]; }
+
+    // Without arguments the value is default constructed from f.
+    std::pair<iterator, bool> try_emplace(const K& k) {
+        auto i = M::try_emplace(k, lazy_default<K>{&f, &k});
+        stats_.dict_lookup(i.second);
+        return i;
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(const K& k, Args&&... args) {
+        return M::try_emplace(k, std::forward<Args>(args)...);
+    }
+
+    // Same as try_emplace, for callers that already hashed k with
+    // M::hash. The node based std::unordered_map cannot be handed a hash,
+    // so there it is only a hint.
+    std::pair<iterator, bool> try_emplace_hashed(size_t h, const K& k) {
+        if constexpr (is_flat_map<M>::value) {
+            auto i = M::try_emplace_hashed(h, k, lazy_default<K>{&f, &k});
+            stats_.dict_lookup(i.second);
+            return i;
+        } else {
+            return try_emplace(k);
+        }
+    }
+
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace_hashed(size_t h, const K& k,
+                                                 Args&&... args) {
+        if constexpr (is_flat_map<M>::value)
+            return M::try_emplace_hashed(h, k, std::forward<Args>(args)...);
+        else
+            return try_emplace(k, std::forward<Args>(args)...);
+    }
+
+    // Same as operator[] on every key of [first, last), writing a pointer to
+    // each value to out, and returning the end of the output. Lookups are
+    // batched as in batched_lookup. Room is made for all the keys first, so
+    // the pointers stay valid until the next insertion. A clock_map makes
+    // room by evicting other keys than those of the batch, and throws
+    // std::length_error when the batch holds more keys than its capacity.
+    template<class It, class Out>
+    Out get_many(It first, It last, Out out) {
+        static_assert(is_forward_iterator<It>::value,
+                      "get_many reads keys twice");
+        if constexpr (is_clock_map<M>::value)
+            M::make_room(first, last);
+        else
+            reserve_for(*this,
+                        this->size() + size_t(std::distance(first, last)));
+        batched_lookup(static_cast<const M&>(*this), first, last,
+                       [&](size_t h, const K& k) {
+                           *out++ = &try_emplace_hashed(h, k).first->second;
+                       });
+        return out;
+    }
+
+    template<class R, class Out>
+    Out get_many(const R& keys, Out out) {
+        return get_many(std::begin(keys), std::end(keys), out);
+    }
+
+    // The stats of the defaultdict, along with those of M if it keeps stats
+    // of the same type.
+    Stats stats() const {
+        Stats s = stats_;
+        if constexpr (has_stats<M, Stats>::value) s += M::stats();
+        return s;
+    }
+    void reset_stats() {
+        stats_ = Stats();
+        if constexpr (has_stats<M, Stats>::value) M::reset_stats();
+    }
+
+private:
+    [[no_unique_address]] Stats stats_;
+};
+
+// A defaultdict over Map, by default a std::unordered_map, of the values
+// that f returns.
+template<class K, template<class...> class Map = std::unordered_map, class F>
+auto make_defaultdict(F f) {
+    typedef typename factory_result<F, K>::type V;
+    return defaultdict<K, V, Map<K, V>, F>(std::move(f));
+}
+
+//-----clock_map-----
+// flat_map of at most capacity entries, which makes room for a new one by
+// evicting an entry not used lately, as picked by CLOCK: a hand sweeps the
+// slots, clearing the referenced bit of the entries it passes, and stops at
+// the first one without it. find, try_emplace, operator[] and insert set
+// the bit of their entry. The bits take a byte per slot next to the table,
+// and stay behind when it rehashes in place, which CLOCK can afford as they
+// are only hints. The other insertions of flat_map do not evict.
+template<class K, class V, class Hash = std::hash<K>,
+         class Eq = std::equal_to<K>,
+         class Alloc = std::allocator<std::pair<const K, V>>,
+         class Stats = no_stats>
+struct clock_map : flat_map<K, V, Hash, Eq, Alloc, Stats> {
+    typedef flat_map<K, V, Hash, Eq, Alloc, Stats> M;
+    typedef typename M::iterator iterator;
+    typedef typename M::const_iterator const_iterator;
+    typedef typename M::value_type value_type;
+
+    explicit clock_map(size_t capacity, const Alloc& a = Alloc())
+            : M(a), limit_(std::max<size_t>(capacity, 1)) {
+        M::reserve(limit_);
+    }
+
+    size_t capacity() const { return limit_; }
+
+    template<class Q>
+    iterator find(const Q& k) { return touch(M::find(k)); }
+    template<class Q>
+    const_iterator find(const Q& k) const { return M::find(k); }
+
+    // On a miss in a full map, the entry is evicted before the value is
+    // built.
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace(const K& k, Args&&... args) {
+        size_t h = this->hash(k);
+        auto i = M::find(k, h);
+        if (i != this->end()) return {touch(i), false};
+        if (this->size() >= limit_) evict();
+        auto r = M::try_emplace_hashed(h, k, std::forward<Args>(args)...);
+        return {touch(r.first), true};
+    }
+
+    V& operator[](const K& k) { return try_emplace(k).first->second; }
+
+    std::pair<iterator, bool> insert(const value_type& v) {
+        return try_emplace(v.first, v.second);
+    }
+    std::pair<iterator, bool> insert(value_type&& v) {
+        return try_emplace(v.first, std::move(v.second));
+    }
+
+    void reserve(size_t n) { M::reserve(std::min(n, limit_)); }
+
+    // Makes room for the keys of [first, last) that are missing, evicting
+    // other keys first, so that inserting them evicts nothing and pointers
+    // to the values of all the keys stay valid until the next insertion.
+    // Throws std::length_error when there are more keys than the capacity.
+    template<class It>
+    void make_room(It first, It last) {
+        sync();
+        std::vector<size_t> pinned;
+        flat_map<K, char, Hash, Eq> fresh;
+        for (It i = first; i != last; ++i) {
+            auto j = M::find(*i);
+            if (j == this->end()) {
+                fresh.try_emplace(*i, 0);
+            } else if (bits_[this->slot_of(j)] != pin) {
+                bits_[this->slot_of(j)] = pin;
+                pinned.push_back(this->slot_of(j));
+            }
+        }
+        bool fits = fresh.size() <= limit_ - pinned.size();
+        if (fits) {
+            while (fresh.size() > limit_ - this->size()) evict();
+        }
+        for (size_t s : pinned) bits_[s] = 1;
+        if (!fits)
+            throw std::length_error("clock_map::make_room: batch too large");
+        M::reserve(this->size() + fresh.size());
+    }
+
+    // The stats of the table, along with its evictions.
+    Stats stats() const {
+        Stats s = M::stats();
+        s += stats_;
+        return s;
+    }
+    void reset_stats() {
+        M::reset_stats();
+        stats_ = Stats();
+    }
+
+private:
+    // The mark of the entries make_room keeps, which evict() passes over.
+    static constexpr unsigned char pin = 2;
+
+    size_t limit_, hand_ = 0;
+    std::vector<unsigned char> bits_;
+    [[no_unique_address]] Stats stats_;
+
+    void sync() {
+        if (bits_.size() != this->bucket_count())
+            bits_.assign(this->bucket_count(), 0);
+    }
+
+    iterator touch(iterator i) {
+        if (i != this->end()) {
+            sync();
+            bits_[this->slot_of(i)] = 1;
+        }
+        return i;
+    }
+
+    void evict() {
+        sync();
+        for (iterator i = this->from_slot(hand_);; ++i) {
+            if (i == this->end()) i = this->begin();
+            size_t s = this->slot_of(i);
+            if (bits_[s] == pin) continue;
+            if (!bits_[s]) {
+                hand_ = s + 1;
+                M::erase(i);
+                stats_.evict();
+                return;
+            }
+            bits_[s] = 0;
+        }
+    }
+};
+
+// A defaultdict bounded to the capacity of its clock_map, which counts its
+// hits, misses and evictions.
+template<class K, class V, class F = V (*)(), class Hash = std::hash<K>,
+         class Eq = std::equal_to<K>>
+using clock_defaultdict = defaultdict<K, V,
+        clock_map<K, V, Hash, Eq, std::allocator<std::pair<const K, V>>,
+                  lookup_stats>, F, lookup_stats>;
+
+template<class K, class F>
+auto make_clock_defaultdict(size_t capacity, F f) {
+    typedef clock_defaultdict<K, typename factory_result<F, K>::type, F> D;
+    return D(std::move(f), typename D::M(capacity));
+}
+
+//-----concurrent_defaultdict-----
+// clock_defaultdict striped over a power of two number of shards, as in
+// concurrent_counter, each of capacity / shards entries behind its own
+// mutex. get(k) returns a copy of the value, which another thread may evict
+// right after, and calls the factory under the lock of the shard of k, so
+// that threads missing the same key wait for one call of it.
+template<class K, class V, class F = V (*)(), class Hash = std::hash<K>>
+struct concurrent_defaultdict {
+    typedef clock_defaultdict<K, V, F, Hash> dict_type;
+
+    concurrent_defaultdict(size_t capacity, F f, size_t n = 16) : bits(0) {
+        while ((size_t(1) << bits) < n) ++bits;
+        n = size_t(1) << bits;
+        for (size_t i = 0; i < n; ++i)
+            shards.push_back(
+                    std::make_unique<shard>((capacity + n - 1) / n, f));
+    }
+
+    V get(const K& k) {
+        shard& s = *shards[shard_of(k)];
+        std::lock_guard<std::mutex> l(s.m);
+        return s.d[k];
+    }
+
+    size_t erase(const K& k) {
+        shard& s = *shards[shard_of(k)];
+        std::lock_guard<std::mutex> l(s.m);
+        return s.d.erase(k);
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> l(s->m);
+            n += s->d.size();
+        }
+        return n;
+    }
+
+    size_t capacity() const { return shards.size() * shards[0]->d.capacity(); }
+    size_t shard_count() const { return shards.size(); }
+
+    lookup_stats stats() const {
+        lookup_stats t;
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> l(s->m);
+            t += s->d.stats();
+        }
+        return t;
+    }
+
+    void reset_stats() {
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> l(s->m);
+            s->d.reset_stats();
+        }
+    }
+
+private:
+    struct alignas(64) shard {
+        shard(size_t capacity, F f)
+            : d(std::move(f), typename dict_type::M(capacity)) {}
+        mutable std::mutex m;
+        dict_type d;
+    };
+
+    unsigned bits;
+    std::vector<std::unique_ptr<shard>> shards;
+
+    size_t shard_of(const K& k) const {
+        uint64_t h = Hash()(k) * 0x9e3779b97f4a7c15ULL;
+        return bits ? size_t(h >> (64 - bits)) : 0;
+    }
+};
+
+//-----Counter-----
+// Unsigned count that stops at its maximum instead of wrapping around, and at
+// 0 instead of going below, for counters with narrow counts.
+template<class U>
+struct saturating {
+    static_assert(std::is_unsigned<U>::value,
+                  "saturating needs an unsigned type");
+    static constexpr U max = std::numeric_limits<U>::max();
+    U v = 0;
+
+    saturating() = default;
+    template<class N, class = std::enable_if_t<std::is_integral<N>::value>>
+    saturating(N n) { *this += n; }
+    operator U() const { return v; }
+
+    template<class N>
+    saturating& operator+=(N n) {
+        if constexpr (std::is_signed<N>::value)
+            if (n < 0) return sub(uint64_t(-(n + 1)) + 1);
+        return add(uint64_t(n));
+    }
+    template<class N>
+    saturating& operator-=(N n) {
+        if constexpr (std::is_signed<N>::value)
+            if (n < 0) return add(uint64_t(-(n + 1)) + 1);
+        return sub(uint64_t(n));
+    }
+    saturating& operator+=(saturating n) { return add(n.v); }
+    saturating& operator-=(saturating n) { return sub(n.v); }
+    saturating& operator++() { return add(1); }
+    saturating& operator--() { return sub(1); }
+
+private:
+    saturating& add(uint64_t n) {
+        v = n > uint64_t(max - v) ? max : U(v + n);
+        return *this;
+    }
+    saturating& sub(uint64_t n) {
+        v = n > v ? U(0) : U(v - n);
+        return *this;
+    }
+};
+
+// The type that Counter::total() sums counts of type C into.
+template<class C, class = void>
+struct wide_count { typedef C type; };
+
+template<class C>
+struct wide_count<C, std::enable_if_t<std::is_integral<C>::value>> {
+    typedef std::conditional_t<std::is_signed<C>::value,
+                               long long, unsigned long long> type;
+};
+
+template<class C>
+struct wide_count<C, std::enable_if_t<std::is_floating_point<C>::value>> {
+    typedef std::conditional_t<(sizeof(C) > sizeof(double)), C, double> type;
+};
+
+template<class U>
+struct wide_count<saturating<U>> : wide_count<U> {};
+
+// Whether an operation on a Counter keeps the counts that end up at zero or
+// below, as += and -= do, or erases them, as Python's Counter does in all
+// its operators.
+enum class nonpositive { keep, erase };
+
+// Counts have the mapped type of Map: a narrow or saturating one keeps the
+// table small, a wide or floating point one makes room for long streams and
+// weights.
+template<class T, class Map = std::unordered_map<T, int>>
+struct Counter : Map {
+    typedef typename Map::iterator iterator;
+    typedef typename Map::value_type value_type;
+    typedef typename Map::allocator_type allocator_type;
+    typedef typename Map::mapped_type count_type;
+    typedef std::vector<std::pair<T, count_type>,
+            typename std::allocator_traits<allocator_type>::template
+            rebind_alloc<std::pair<T, count_type>>>
+            item_vector;
+
+    Counter(std::initializer_list<std::pair<const T, count_type>> il) :
+            Map(il) {}
+    Counter(std::initializer_list<std::pair<const T, count_type>> il,
+            const allocator_type& a) : Map(a) {
+        this->insert(il.begin(), il.end());
+    }
+    Counter() = default;
+    explicit Counter(const allocator_type& a) : Map(a) {}
+    Counter(const Counter& c, const allocator_type& a) : Map(c, a) {}
+
+    using Map::operator[];
+
+    // When Map looks up other types than T, t is only converted to T on a
+    // miss.
+    template<class Q, class = std::enable_if_t<
+            is_transparent_map<Map>::value && !std::is_same<Q, T>::value>>
+    count_type& operator[](const Q& t) {
+        return find_or_emplace(static_cast<Map&>(*this), t).first->second;
+    }
+
+    struct Iter {
+        iterator curr, end;
+        count_type count;
+        Iter(iterator i, iterator e) :
+                curr(i), end(e), count(i == e ? count_type() : i->second) {}
+        const T& operator*() { return curr->first; }
+        Iter& operator++() {
+            --count;
+            while (count <= 0 && ++curr != end)
+                count = curr->second;
+            return *this;
+        }
+        Iter operator++(int) {
+            Iter i = *this;
+            ++*this;
+            return i;
+        }
+        bool operator!=(const Iter &i) { return curr != i.curr; }
+    };
+
+    range<Iter> elements() {
+        iterator i = this->begin(), j = this->end();
+        while (i != j && i->second <= 0) ++i;
+        return {{i, j}, {j, j}};
+    }
+
+    // Iterates over the entries with a positive count.
+    struct RunIter {
+        typename Map::const_iterator curr, end;
+        RunIter(typename Map::const_iterator i,
+                typename Map::const_iterator e) : curr(i), end(e) { skip(); }
+        const value_type& operator*() const { return *curr; }
+        const value_type* operator->() const { return &*curr; }
+        RunIter& operator++() {
+            ++curr;
+            skip();
+            return *this;
+        }
+        RunIter operator++(int) {
+            RunIter i = *this;
+            ++*this;
+            return i;
+        }
+        bool operator!=(const RunIter &i) const { return curr != i.curr; }
+        void skip() { while (curr != end && curr->second <= 0) ++curr; }
+    };
+
+    range<RunIter> runs() const {
+        return {{this->begin(), this->end()}, {this->end(), this->end()}};
+    }
+
+    // Writes what elements() iterates over, a run at a time.
+    template<class OutputIt>
+    OutputIt expand_into(OutputIt out) const {
+        for (const value_type& t : runs())
+            out = std::fill_n(out, size_t(t.second), t.first);
+        return out;
+    }
+
+#ifdef __cpp_lib_span
+    // Returns the part of s written to. Throws if s is too small.
+    std::span<T> expand_into(std::span<T> s) const {
+        size_t n = 0;
+        for (const value_type& t : runs()) n += size_t(t.second);
+        if (n > s.size())
+            throw std::length_error("Counter::expand_into: span too small");
+        expand_into(s.begin());
+        return s.first(n);
+    }
+#endif
+
+    // Keeps the n most common entries seen so far in a min-heap, so only n
+    // entries are ever copied. v is cleared and its storage reused.
+    void most_common(item_vector& v, int n=0) const {
+        auto greater = [](const std::pair<T, count_type> &l,
+                          const std::pair<T, count_type> &r) {
+                              return l.second > r.second;
+                          };
+        v.clear();
+        if (n <= 0 || size_t(n) >= this->size()) {
+            v.assign(this->begin(), this->end());
+            std::sort(v.begin(), v.end(), greater);
+            return;
+        }
+        v.reserve(n);
+        auto i = this->begin(), e = this->end();
+        for (; v.size() < size_t(n); ++i) v.emplace_back(*i);
+        std::make_heap(v.begin(), v.end(), greater);
+        for (; i != e; ++i) {
+            if (i->second <= v.front().second) continue;
+            std::pop_heap(v.begin(), v.end(), greater);
+            v.back() = *i;
+            std::push_heap(v.begin(), v.end(), greater);
+        }
+        std::sort_heap(v.begin(), v.end(), greater);
+    }
+
+    item_vector most_common(int n=0) const {
+        item_vector v(this->get_allocator());
+        most_common(v, n);
+        return v;
+    }
+
+    count_type& at(const T& t) = delete;
+
+    Counter& update(std::initializer_list<T> l) {
+        for (const T& t : l) ++(*this)[t];
+        return *this;
+    }
+
+    template<class It>
+    Counter& update(It first, It last) {
+        if constexpr (is_random_access_iterator<It>::value)
+            reserve_more(size_t(last - first));
+        return count_runs(first, last);
+    }
+
+    template<class R, class = decltype(std::end(std::declval<const R&>()))>
+    Counter& update(const R& r) {
+        if constexpr (is_sized_range<const R>::value)
+            reserve_more(std::size(r));
+        return count_runs(std::begin(r), std::end(r));
+    }
+
+    // Counts the tokens of text separated by runs of the bytes in seps. In a
+    // Map with transparent lookup, such as flat_counter<std::string,
+    // count_type, string_hash>, tokens are looked up as std::string_view and
+    // a key is only built for a token seen for the first time.
+    Counter& update_tokens(std::string_view text,
+                           std::string_view seps = " \t\n\v\f\r") {
+        separators sep(seps);
+        count_tokens(text, sep, true);
+        return *this;
+    }
+
+    // Same as update_tokens on everything read from is, read chunk bytes at
+    // a time, with a token cut by the end of a chunk carried over to the
+    // next one. Throws std::ios_base::failure if reading fails.
+    Counter& ingest(std::istream& is, size_t chunk = size_t(1) << 20,
+                    std::string_view seps = " \t\n\v\f\r") {
+        return ingest_chunks([&](char* p, size_t n) {
+            is.read(p, std::streamsize(n));
+            if (is.bad()) throw std::ios_base::failure("Counter::ingest");
+            return size_t(is.gcount());
+        }, chunk, seps);
+    }
+
+#if __has_include(<unistd.h>)
+    // Same as ingest(istream), from a file descriptor, such as a file or a
+    // socket, until end of file. Throws std::system_error if reading fails.
+    Counter& ingest(int fd, size_t chunk = size_t(1) << 20,
+                    std::string_view seps = " \t\n\v\f\r") {
+        return ingest_chunks([&](char* p, size_t n) {
+            ssize_t r;
+            while ((r = ::read(fd, p, n)) < 0 && errno == EINTR) {}
+            if (r < 0)
+                throw std::system_error(errno, std::generic_category(),
+                                        "Counter::ingest");
+            return size_t(r);
+        }, chunk, seps);
+    }
+#endif
+
+    // Adds one to the count of every key of [first, last), looking them up
+    // in batches as in batched_lookup. Unlike update, it does not coalesce
+    // runs of equal keys.
+    template<class It>
+    Counter& increment_many(It first, It last) {
+        batched_lookup(static_cast<const Map&>(*this), first, last,
+                       [this](size_t h, const T& t) {
+                           if constexpr (is_flat_map<Map>::value)
+                               ++this->try_emplace_hashed(h, t).first->second;
+                           else
+                               ++(*this)[t];
+                       });
+        return *this;
+    }
+
+    template<class R>
+    Counter& increment_many(const R& keys) {
+        return increment_many(std::begin(keys), std::end(keys));
+    }
+
+    Counter& operator+=(const Counter &c) { return add(c); }
+
+    Counter& operator-=(const Counter &c) { return subtract(c); }
+
+    // Counts each of threads slices of r into its own Counter, then merges
+    // them pairwise in parallel. r must be random access.
+    template<class R>
+    static Counter from_parallel(const R& r,
+                                 unsigned threads = default_threads()) {
+        size_t n = std::size(r);
+        threads = std::max(1u, unsigned(std::min<size_t>(threads, n)));
+        std::vector<Counter> parts(threads);
+        parallel_for(threads, [&](unsigned i) {
+            parts[i].update(std::begin(r) + n * i / threads,
+                            std::begin(r) + n * (i + 1) / threads);
+        });
+        return merge_tree(std::move(parts), threads);
+    }
+
+    // Sums parts pairwise, in rounds that halve their number, each merging
+    // its pairs on up to threads threads, and the smaller of a pair into the
+    // larger.
+    static Counter merge_tree(std::vector<Counter> parts,
+                              unsigned threads = default_threads()) {
+        if (parts.empty()) return Counter();
+        for (size_t step = 1; step < parts.size(); step *= 2) {
+            size_t pairs = (parts.size() + 2 * step - 1) / (2 * step);
+            unsigned k =
+                    std::max(1u, unsigned(std::min<size_t>(threads, pairs)));
+            parallel_for(k, [&](unsigned w) {
+                for (size_t i = w; i < pairs; i += k) {
+                    size_t a = 2 * step * i, b = a + step;
+                    if (b >= parts.size()) continue;
+                    if (parts[a].size() < parts[b].size())
+                        parts[a].swap(parts[b]);
+                    parts[a] += parts[b];
+                    Counter().swap(parts[b]);
+                }
+            });
+        }
+        return std::move(parts[0]);
+    }
+
+    // Same as += c, adding to the keys already present from threads threads
+    // at once, as lookups alone never modify the table. Keys new to this
+    // counter are inserted afterwards, in one pass. Lookups do record their
+    // probes in a map keeping lookup_stats, so such a map is merged as by +=.
+    Counter& merge_parallel(const Counter& c,
+                            unsigned threads = default_threads()) {
+        if constexpr (has_stats<Map, lookup_stats>::value)
+            return *this += c;
+        std::vector<const value_type*> src;
+        src.reserve(c.size());
+        for (auto &t : c) src.push_back(&t);
+        threads = std::max(1u, unsigned(std::min<size_t>(threads, src.size())));
+        std::vector<std::vector<const value_type*>> missing(threads);
+        parallel_for(threads, [&](unsigned i) {
+            size_t b = src.size() * i / threads,
+                   e = src.size() * (i + 1) / threads;
+            for (; b < e; ++b) {
+                auto j = this->find(src[b]->first);
+                if (j != this->end()) j->second += src[b]->second;
+                else missing[i].push_back(src[b]);
+            }
+        });
+        size_t n = 0;
+        for (auto &m : missing) n += m.size();
+        reserve_for(*this, this->size() + n);
+        for (auto &m : missing)
+            for (const value_type* t : m) (*this)[t->first] += t->second;
+        return *this;
+    }
+
+    // The result uses the allocator of *this.
+    Counter operator+(const Counter &c) {
+        Counter ct(*this, this->get_allocator());
+        ct += c;
+        return ct;
+    }
+
+    Counter operator-(const Counter &c) {
+        Counter ct(*this, this->get_allocator());
+        ct -= c;
+        return ct;
+    }
+
+    Counter& add(const Counter& c, nonpositive np = nonpositive::keep) {
+        return combine(c, [](count_type& x, const count_type& y) { x += y; },
+                       np);
+    }
+
+    // Same as -=, and Python's subtract, which keeps counts at zero or below
+    // unless asked not to. Given keys, subtracts one per key, as update adds
+    // one.
+    Counter& subtract(const Counter& c, nonpositive np = nonpositive::keep) {
+        return combine(c, [](count_type& x, const count_type& y) { x -= y; },
+                       np);
+    }
+
+    template<class It>
+    Counter& subtract(It first, It last) {
+        for (; first != last; ++first) --(*this)[*first];
+        return *this;
+    }
+
+    Counter& subtract(std::initializer_list<T> il) {
+        return subtract(il.begin(), il.end());
+    }
+
+    // The greater count of each key, keeping only positive ones.
+    Counter& operator|=(const Counter& c) {
+        return combine(c, [](count_type& x, const count_type& y) {
+            if (x < y) x = y;
+        }, nonpositive::erase);
+    }
+
+    // The lesser count of each key, keeping only positive ones, so only keys
+    // of both counters.
+    Counter& operator&=(const Counter& c) {
+        if constexpr (is_flat_map<Map>::value) {
+            this->zip(c, [&](value_type* t, const value_type* u) {
+                if (!t) return;
+                if (!u) {
+                    auto j = c.find(t->first);
+                    if (j == c.end()) return void(t->second = count_type());
+                    u = &*j;
+                }
+                if (u->second < t->second) t->second = u->second;
+            });
+            return prune();
+        }
+        for (auto &t : *this) {
+            auto j = c.find(t.first);
+            if (j == c.end()) t.second = count_type();
+            else if (j->second < t.second) t.second = j->second;
+        }
+        return prune();
+    }
+
+    Counter operator|(const Counter& c) const {
+        Counter ct(*this, this->get_allocator());
+        ct |= c;
+        return ct;
+    }
+
+    Counter operator&(const Counter& c) const {
+        Counter ct(*this, this->get_allocator());
+        ct &= c;
+        return ct;
+    }
+
+    // Python's unary + and -: the positive counts, and the negative counts
+    // negated.
+    Counter operator+() const {
+        Counter ct(this->get_allocator());
+        for (auto &t : *this)
+            if (count_type() < t.second) ct.emplace(t.first, t.second);
+        return ct;
+    }
+
+    Counter operator-() const {
+        Counter ct(this->get_allocator());
+        for (auto &t : *this) {
+            if (!(t.second < count_type())) continue;
+            count_type n = count_type();
+            n -= t.second;
+            ct.emplace(t.first, n);
+        }
+        return ct;
+    }
+
+    // Erases the keys whose count is zero or below, as +c in place.
+    Counter& prune() {
+        for (auto i = this->begin(); i != this->end();) {
+            if (count_type() < i->second) ++i;
+            else i = this->erase(i);
+        }
+        return *this;
+    }
+
+    typename wide_count<count_type>::type total() const {
+        typename wide_count<count_type>::type s = 0;
+        for (auto &t : *this) s += t.second;
+        return s;
+    }
+
+private:
+    // Applies op(x, y) to the count x of every key of c, a missing key
+    // counting from zero, with y its count in c. flat_maps are walked side by
+    // side with zip, looking up only the keys in slots that differ, ordered
+    // maps merged in key order, other maps looked up key by key.
+    template<class Op>
+    Counter& combine(const Counter& c, Op op, nonpositive np) {
+        if constexpr (is_flat_map<Map>::value) {
+            std::vector<const value_type*> rest;
+            this->zip(c, [&](value_type* t, const value_type* u) {
+                if (t && u) op(t->second, u->second);
+                else if (u) rest.push_back(u);
+            });
+            for (const value_type* u : rest) op((*this)[u->first], u->second);
+        } else if constexpr (is_ordered_map<Map>::value) {
+            auto comp = this->key_comp();
+            auto i = this->begin();
+            for (auto &t : c) {
+                while (i != this->end() && comp(i->first, t.first)) ++i;
+                if (i == this->end() || comp(t.first, i->first))
+                    i = this->emplace_hint(i, t.first, count_type());
+                op(i->second, t.second);
+                ++i;
+            }
+        } else {
+            for (auto &t : c) op((*this)[t.first], t.second);
+        }
+        return np == nonpositive::erase ? prune() : *this;
+    }
+
+    struct separators {
+        bool is[256] = {};
+        explicit separators(std::string_view s) {
+            for (char c : s) is[static_cast<unsigned char>(c)] = true;
+        }
+        bool operator()(char c) const {
+            return is[static_cast<unsigned char>(c)];
+        }
+    };
+
+    count_type& token(std::string_view t) {
+        return find_or_emplace(static_cast<Map&>(*this), t).first->second;
+    }
+
+    // Returns the length of text taken up by the tokens counted. Unless last,
+    // a token running to the end of text may be cut and is left uncounted.
+    size_t count_tokens(std::string_view text, const separators& sep,
+                        bool last) {
+        const char *p = text.data(), *e = p + text.size();
+        for (;;) {
+            while (p != e && sep(*p)) ++p;
+            const char* b = p;
+            while (p != e && !sep(*p)) ++p;
+            if (p == e && !last) return b - text.data();
+            if (b == p) return text.size();
+            ++token(std::string_view(b, p - b));
+        }
+    }
+
+    // The buffer only grows to hold a token longer than a chunk.
+    template<class Read>
+    Counter& ingest_chunks(Read read, size_t chunk, std::string_view seps) {
+        separators sep(seps);
+        std::vector<char> buf(std::max<size_t>(chunk, 1));
+        size_t carry = 0;
+        for (;;) {
+            if (carry == buf.size()) buf.resize(buf.size() * 2);
+            size_t n = read(buf.data() + carry, buf.size() - carry);
+            std::string_view text(buf.data(), carry + n);
+            size_t used = count_tokens(text, sep, !n);
+            if (!n) return *this;
+            carry = text.size() - used;
+            std::memmove(buf.data(), buf.data() + used, carry);
+        }
+    }
+
+    // Makes room ahead of counting n keys. Keys usually repeat, so room is
+    // made for 64K new ones at most, and the table grows past that as they
+    // arrive.
+    void reserve_more(size_t n) {
+        reserve_for(*this, this->size() + std::min(n, size_t(1) << 16));
+    }
+
+    // Adjacent equal keys, as in sorted or clustered input, are counted with
+    // a single lookup. Input iterators cannot be read twice and are counted
+    // one by one.
+    template<class It>
+    Counter& count_runs(It first, It last) {
+        if constexpr (is_forward_iterator<It>::value) {
+            auto eq = key_equivalence(static_cast<const Map&>(*this));
+            while (first != last) {
+                It run = first;
+                size_t n = 0;
+                do ++first, ++n; while (first != last && eq(*first, *run));
+                (*this)[*run] += n;
+            }
+        } else {
+            for (; first != last; ++first) ++(*this)[*first];
+        }
+        return *this;
+    }
+};
+
+template<class T, class C = int, class Stats = no_stats>
+using flat_counter = Counter<T, flat_map<T, C, std::hash<T>, std::equal_to<T>,
+        std::allocator<std::pair<const T, C>>, Stats>>;
+
+// Counter of strings that update_tokens and ingest fill without building a
+// std::string per token.
+template<class C = int>
+using string_counter = Counter<std::string, flat_map<std::string, C,
+                                                     string_hash,
+                                                     std::equal_to<>>>;
+
+template<class K, class V, class F = V (*)(), class Stats = no_stats>
+using flat_defaultdict = defaultdict<K, V, flat_map<K, V, std::hash<K>,
+        std::equal_to<K>, std::allocator<std::pair<const K, V>>, Stats>,
+        F, Stats>;
+
+// Containers drawing their memory from a std::pmr::memory_resource, which
+// operator+, operator-, most_common and ChainMap::one_map pass on.
+namespace pmr {
+template<class K, class V, class Hash = std::hash<K>,
+         class Eq = std::equal_to<K>>
+using flat_map = ::flat_map<K, V, Hash, Eq,
+        std::pmr::polymorphic_allocator<std::pair<const K, V>>>;
+
+template<class T, class C = int>
+using Counter = ::Counter<T, std::pmr::unordered_map<T, C>>;
+
+template<class K, class V, class F = V (*)()>
+using defaultdict = ::defaultdict<K, V, std::pmr::unordered_map<K, V>, F>;
+
+template<class T, class C = int>
+using flat_counter = ::Counter<T, pmr::flat_map<T, C>>;
+
+template<class K, class V, class F = V (*)()>
+using flat_defaultdict = ::defaultdict<K, V, pmr::flat_map<K, V>, F>;
+}
+
+//-----ranked_counter-----
+// Counter that keeps its entries sorted by count, in a list of buckets holding
+// one distinct count each, from the most common to the least. Changing a
+// count by one relinks the entry into a neighbouring bucket in O(1), by d it
+// walks at most d buckets. most_common(n) reads the first n entries in O(n)
+// and total() is kept up to date.
+template<class T>
+struct ranked_counter {
+    struct bucket;
+    typedef typename std::list<bucket>::iterator bucket_iter;
+
+    struct entry {
+        const T* key;
+        int count;
+        bucket_iter b;
+        entry *prev, *next;
+    };
+
+    struct bucket {
+        int count;
+        entry* head;
+    };
+
+    // Reference to a count; writes through it keep the buckets ordered.
+    struct ref {
+        ranked_counter* c;
+        entry* e;
+        operator int() const { return e->count; }
+        ref& operator=(int n) { c->move(e, n); return *this; }
+        ref& operator+=(int n) { c->move(e, e->count + n); return *this; }
+        ref& operator-=(int n) { c->move(e, e->count - n); return *this; }
+        ref& operator++() { return *this += 1; }
+        ref& operator--() { return *this -= 1; }
+        int operator++(int) { int n = e->count; ++*this; return n; }
+        int operator--(int) { int n = e->count; --*this; return n; }
+    };
+
+    ranked_counter() = default;
+    ranked_counter(std::initializer_list<std::pair<const T, int>> il) {
+        for (auto &t : il) (*this)[t.first] += t.second;
+    }
+    ranked_counter(ranked_counter&&) = default;
+
+    // Buckets are rebuilt in order, without searching for positions.
+    ranked_counter(const ranked_counter& c) : sum(c.sum) {
+        entries.reserve(c.entries.size());
+        for (const bucket& b : c.buckets) {
+            bucket_iter nb = buckets.insert(buckets.end(), {b.count, nullptr});
+            for (entry* e = b.head; e; e = e->next) {
+                auto t = entries.try_emplace(*e->key).first;
+                t->second.key = &t->first;
+                t->second.count = e->count;
+                link(&t->second, nb);
+            }
+        }
+    }
+
+    ranked_counter& operator=(ranked_counter c) {
+        entries.swap(c.entries), buckets.swap(c.buckets);
+        std::swap(sum, c.sum);
+        return *this;
+    }
+
+    ref operator[](const T& t) {
+        auto i = entries.try_emplace(t);
+        entry* e = &i.first->second;
+        if (i.second) {
+            e->key = &i.first->first;
+            e->count = 0;
+            link(e, locate(buckets.empty() ? buckets.end() :
+                           std::prev(buckets.end()), 0));
+        }
+        return {this, e};
+    }
+
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    long long total() const { return sum; }
+
+    void most_common(std::vector<std::pair<T, int>>& v, int n=0) const {
+        v.clear();
+        size_t k = n <= 0 ? entries.size() :
+                   std::min(size_t(n), entries.size());
+        v.reserve(k);
+        for (auto b = buckets.begin(); v.size() < k; ++b)
+            for (entry* e = b->head; e && v.size() < k; e = e->next)
+                v.emplace_back(*e->key, e->count);
+    }
+
+    std::vector<std::pair<T, int>> most_common(int n=0) const {
+        std::vector<std::pair<T, int>> v;
+        most_common(v, n);
+        return v;
+    }
+
+    ranked_counter& update(std::initializer_list<T> l) {
+        for (const T& t : l) ++(*this)[t];
+        return *this;
+    }
+
+    template<class Map>
+    ranked_counter& operator+=(const Map &c) {
+        for (auto &t : c) (*this)[t.first] += t.second;
+        return *this;
+    }
+
+    template<class Map>
+    ranked_counter& operator-=(const Map &c) {
+        for (auto &t : c) (*this)[t.first] -= t.second;
+        return *this;
+    }
+
+    ranked_counter& operator+=(const ranked_counter &c) {
+        for (auto &t : c.entries) (*this)[t.first] += t.second.count;
+        return *this;
+    }
+
+    ranked_counter& operator-=(const ranked_counter &c) {
+        for (auto &t : c.entries) (*this)[t.first] -= t.second.count;
+        return *this;
+    }
+
+private:
+    std::unordered_map<T, entry> entries;
+    std::list<bucket> buckets;
+    long long sum = 0;
+
+    // The bucket of count n, created if needed by walking from b.
+    bucket_iter locate(bucket_iter b, int n) {
+        if (b == buckets.end() || n < b->count) {
+            while (b != buckets.end() && b->count > n) ++b;
+        } else {
+            while (b != buckets.begin() && std::prev(b)->count <= n) --b;
+        }
+        if (b != buckets.end() && b->count == n) return b;
+        return buckets.insert(b, {n, nullptr});
+    }
+
+    void link(entry* e, bucket_iter b) {
+        e->b = b, e->prev = nullptr, e->next = b->head;
+        if (b->head) b->head->prev = e;
+        b->head = e;
+    }
+
+    void unlink(entry* e) {
+        if (e->prev) e->prev->next = e->next;
+        else e->b->head = e->next;
+        if (e->next) e->next->prev = e->prev;
+    }
+
+    void move(entry* e, int n) {
+        if (n == e->count) return;
+        bucket_iter from = e->b, to = locate(from, n);
+        unlink(e);
+        if (!from->head) buckets.erase(from);
+        sum += n - e->count;
+        e->count = n;
+        link(e, to);
+    }
+};
+
+//-----concurrent_counter-----
+// Counter whose keys are striped over a power of two number of shards, each
+// with its own mutex and aligned to a cache line, so that threads counting
+// different keys rarely contend. Bulk updates are grouped by shard first and
+// lock each shard once. Reads lock one shard at a time: every shard is seen
+// in a consistent state, the whole counter only when no writer is running.
+template<class T, class Map = std::unordered_map<T, int>>
+struct concurrent_counter {
+    typedef Counter<T, Map> counter_type;
+    typedef typename counter_type::count_type count_type;
+
+    explicit concurrent_counter(size_t n = 64) : bits(0) {
+        while ((size_t(1) << bits) < n) ++bits;
+        shards = std::vector<shard>(size_t(1) << bits);
+    }
+
+    size_t shard_count() const { return shards.size(); }
+
+    void increment(const T& t, count_type n = 1) {
+        shard& s = shards[shard_of(t)];
+        std::lock_guard<std::mutex> l(s.m);
+        s.c[t] += n;
+    }
+
+    concurrent_counter& update(std::initializer_list<T> l) {
+        return update(l.begin(), l.end());
+    }
+
+    // It must be a forward iterator, as elements are grouped by address.
+    template<class It>
+    concurrent_counter& update(It first, It last) {
+        std::vector<std::vector<const T*>> parts(shards.size());
+        for (; first != last; ++first)
+            parts[shard_of(*first)].push_back(&*first);
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (parts[i].empty()) continue;
+            std::lock_guard<std::mutex> l(shards[i].m);
+            for (const T* t : parts[i]) ++shards[i].c[*t];
+        }
+        return *this;
+    }
+
+    template<class M>
+    concurrent_counter& operator+=(const M &c) {
+        std::vector<std::vector<const typename M::value_type*>>
+                parts(shards.size());
+        for (auto &t : c) parts[shard_of(t.first)].push_back(&t);
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (parts[i].empty()) continue;
+            std::lock_guard<std::mutex> l(shards[i].m);
+            for (auto *t : parts[i]) shards[i].c[t->first] += t->second;
+        }
+        return *this;
+    }
+
+    count_type count(const T& t) const {
+        const shard& s = shards[shard_of(t)];
+        std::lock_guard<std::mutex> l(s.m);
+        auto i = s.c.find(t);
+        return i == s.c.end() ? count_type() : i->second;
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const shard& s : shards) {
+            std::lock_guard<std::mutex> l(s.m);
+            n += s.c.size();
+        }
+        return n;
+    }
+
+    typename wide_count<count_type>::type total() const {
+        typename wide_count<count_type>::type n = 0;
+        for (const shard& s : shards) {
+            std::lock_guard<std::mutex> l(s.m);
+            for (auto &t : s.c) n += t.second;
+        }
+        return n;
+    }
+
+    // The n most common of the whole counter are among the n most common of
+    // their shards.
+    std::vector<std::pair<T, count_type>> most_common(int n=0) const {
+        std::vector<std::pair<T, count_type>> v;
+        typename counter_type::item_vector part;
+        for (const shard& s : shards) {
+            std::lock_guard<std::mutex> l(s.m);
+            s.c.most_common(part, n);
+            v.insert(v.end(), part.begin(), part.end());
+        }
+        auto greater = [](const std::pair<T, count_type> &l,
+                          const std::pair<T, count_type> &r) {
+                              return l.second > r.second;
+                          };
+        size_t k = n <= 0 ? v.size() : std::min(size_t(n), v.size());
+        std::partial_sort(v.begin(), v.begin() + k, v.end(), greater);
+        v.resize(k);
+        return v;
+    }
+
+    counter_type snapshot() const {
+        counter_type c;
+        for (const shard& s : shards) {
+            std::lock_guard<std::mutex> l(s.m);
+            c.insert(s.c.begin(), s.c.end());
+        }
+        return c;
+    }
+
+    // Empties the counter a shard at a time and calls f on the counts taken
+    // from each, outside its lock. Writers to the shard only wait for its
+    // table to be swapped with the one emptied by the previous drain, which
+    // keeps its capacity. Drains must not run concurrently.
+    template<class F>
+    void drain(F f) {
+        for (shard& s : shards) {
+            {
+                std::lock_guard<std::mutex> l(s.m);
+                s.c.swap(s.spare);
+            }
+            f(static_cast<const counter_type&>(s.spare));
+            s.spare.clear();
+        }
+    }
+
+private:
+    struct alignas(64) shard {
+        mutable std::mutex m;
+        counter_type c;
+        counter_type spare;
+    };
+
+    unsigned bits;
+    std::vector<shard> shards;
+
+    // Shards take the high bits of a multiplicative hash, so that keys of a
+    // shard still spread over the low bits its own table uses.
+    size_t shard_of(const T& t) const {
+        uint64_t h = typename Map::hasher()(t) * 0x9e3779b97f4a7c15ULL;
+        return bits ? size_t(h >> (64 - bits)) : 0;
+    }
+};
+
+//-----epoch_counter-----
+// Counter written to through a concurrent_counter of the counts since the
+// last publish() and read through immutable snapshots. publish() drains the
+// writers' shards into the snapshot before the current one, behind it by the
+// counts of one epoch, when its last reader has released it, or else into a
+// copy of the current one, and swaps the result in. Snapshots are freed when
+// both their readers and the counter are done with them.
+template<class T, class Map = std::unordered_map<T, int>>
+struct epoch_counter {
+    typedef Counter<T, Map> counter_type;
+    typedef typename counter_type::count_type count_type;
+    typedef std::shared_ptr<const counter_type> snapshot_type;
+
+    explicit epoch_counter(size_t n = 64)
+        : live(n), front(std::make_shared<counter_type>()) {}
+
+    size_t shard_count() const { return live.shard_count(); }
+
+    void increment(const T& t, count_type n = 1) { live.increment(t, n); }
+
+    epoch_counter& update(std::initializer_list<T> l) {
+        live.update(l);
+        return *this;
+    }
+
+    template<class It>
+    epoch_counter& update(It first, It last) {
+        live.update(first, last);
+        return *this;
+    }
+
+    template<class M>
+    epoch_counter& operator+=(const M &c) {
+        live += c;
+        return *this;
+    }
+
+    snapshot_type snapshot() const {
+        std::lock_guard<std::mutex> l(front_m);
+        return front;
+    }
+
+    // The number of publish() calls so far.
+    size_t epoch() const {
+        std::lock_guard<std::mutex> l(front_m);
+        return epoch_;
+    }
+
+    snapshot_type publish() {
+        std::unique_lock<std::mutex> l(publish_m);
+        std::shared_ptr<counter_type> next;
+        // No reader can take the back snapshot again, so a use count of one
+        // is final, and the fence orders the last reader's release before
+        // the writes.
+        if (back && back.use_count() == 1) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            next = std::move(back);
+            *next += pending;
+        } else {
+            next = std::make_shared<counter_type>(*front);
+        }
+        pending.clear();
+        live.drain([&](const counter_type& d) {
+            *next += d;
+            pending += d;
+        });
+#ifdef __cpp_lib_coroutine
+        std::vector<snapshot_awaiter*> ws;
+#endif
+        {
+            std::lock_guard<std::mutex> f(front_m);
+            back = std::move(front);
+            front = next;
+            ++epoch_;
+#ifdef __cpp_lib_coroutine
+            ws.swap(waiters);
+#endif
+        }
+        l.unlock();
+#ifdef __cpp_lib_coroutine
+        for (snapshot_awaiter* w : ws) {
+            w->s = next;
+            w->h.resume();
+        }
+#endif
+        return next;
+    }
+
+#ifdef __cpp_lib_coroutine
+    // Suspends the awaiting coroutine until the next publish(), which resumes
+    // it on its own thread and hands it the new snapshot.
+    struct snapshot_awaiter {
+        epoch_counter& c;
+        std::coroutine_handle<> h;
+        snapshot_type s;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            h = handle;
+            std::lock_guard<std::mutex> l(c.front_m);
+            c.waiters.push_back(this);
+        }
+        snapshot_type await_resume() { return std::move(s); }
+    };
+
+    snapshot_awaiter next_snapshot() { return {*this, {}, {}}; }
+#endif
+
+private:
+    concurrent_counter<T, Map> live;
+    std::mutex publish_m;
+    mutable std::mutex front_m;
+    std::shared_ptr<counter_type> front, back;
+    // The counts that took back to front.
+    counter_type pending;
+    size_t epoch_ = 0;
+#ifdef __cpp_lib_coroutine
+    std::vector<snapshot_awaiter*> waiters;
+#endif
+};
+
+//-----approx_counter-----
+// Counter of a fixed size, whatever the number of distinct keys. Counts are
+// kept in a Count-Min Sketch of depth rows of width cells, and the capacity
+// keys with the highest estimates in a heavy hitter table: a min-heap indexed
+// by key, where a new key evicts the least one as in Space-Saving.
+//
+// With N the total of all counts, count(t) is never below the true count of
+// t, and exceeds it by more than e / width * N with probability at most
+// exp(-depth). Every key whose true count exceeds that error plus the least
+// count in the table is in most_common(), ordered by estimate. The sketch
+// takes width * depth * 8 bytes, the table capacity entries.
+//
+// Counters of the same width and depth merge with +=, as sketches add up cell
+// by cell; the merged table holds the best of the keys of both.
+template<class T, class Hash = std::hash<T>>
+struct approx_counter {
+    typedef uint64_t count_type;
+    typedef std::vector<std::pair<T, count_type>> item_vector;
+
+    // width is rounded up to a power of two.
+    explicit approx_counter(size_t width = 2048, size_t depth = 4,
+                            size_t capacity = 64)
+        : width_(1), depth_(std::max<size_t>(depth, 1)),
+          capacity_(std::max<size_t>(capacity, 1)) {
+        while (width_ < width) width_ *= 2;
+        cells.assign(width_ * depth_, 0);
+        heap.reserve(capacity_);
+        index.reserve(capacity_);
+    }
+
+    size_t width() const { return width_; }
+    size_t depth() const { return depth_; }
+    size_t capacity() const { return capacity_; }
+    // The number of keys in the heavy hitter table.
+    size_t size() const { return heap.size(); }
+    count_type total() const { return sum; }
+
+    void increment(const T& t, count_type n = 1) {
+        sum += n;
+        track(t, add(hash(t), n));
+    }
+
+    count_type count(const T& t) const { return estimate(hash(t)); }
+
+    approx_counter& update(std::initializer_list<T> l) {
+        return update(l.begin(), l.end());
+    }
+
+    template<class It>
+    approx_counter& update(It first, It last) {
+        for (; first != last; ++first) increment(*first);
+        return *this;
+    }
+
+    template<class R, class = decltype(std::end(std::declval<const R&>()))>
+    approx_counter& update(const R& r) {
+        return update(std::begin(r), std::end(r));
+    }
+
+    void most_common(item_vector& v, int n=0) const {
+        v.assign(heap.begin(), heap.end());
+        std::sort(v.begin(), v.end(), [](const std::pair<T, count_type> &l,
+                                         const std::pair<T, count_type> &r) {
+                                             return l.second > r.second;
+                                         });
+        if (n > 0 && size_t(n) < v.size()) v.resize(n);
+    }
+
+    item_vector most_common(int n=0) const {
+        item_vector v;
+        most_common(v, n);
+        return v;
+    }
+
+    // Throws std::invalid_argument unless c has the same width and depth.
+    approx_counter& operator+=(const approx_counter &c) {
+        if (width_ != c.width_ || depth_ != c.depth_)
+            throw std::invalid_argument(
+                    "approx_counter: merging sketches of different dimensions");
+        for (size_t i = 0; i < cells.size(); ++i) cells[i] += c.cells[i];
+        sum += c.sum;
+        // Estimates only grow, so the heap is rebuilt once rather than sifted.
+        for (auto &t : heap) t.second = estimate(hash(t.first));
+        std::make_heap(heap.begin(), heap.end(), greater);
+        for (size_t i = 0; i < heap.size(); ++i) index[heap[i].first] = i;
+        for (auto &t : c.heap) track(t.first, estimate(hash(t.first)));
+        return *this;
+    }
+
+    // Adds the positive counts of any map of counts, such as a Counter.
+    template<class Map>
+    approx_counter& operator+=(const Map &c) {
+        for (auto &t : c)
+            if (t.second > 0) increment(t.first, count_type(t.second));
+        return *this;
+    }
+
+private:
+    size_t width_, depth_, capacity_;
+    std::vector<count_type> cells;
+    item_vector heap;
+    flat_map<T, size_t, Hash> index;
+    count_type sum = 0;
+
+    static bool greater(const std::pair<T, count_type> &l,
+                        const std::pair<T, count_type> &r) {
+        return l.second > r.second;
+    }
+
+    static size_t hash(const T& t) {
+        uint64_t h = Hash()(t);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        return static_cast<size_t>(h ^ (h >> 33));
+    }
+
+    // Row i uses the cell h + i * step, the step odd so that rows differ.
+    count_type add(size_t h, count_type n) {
+        size_t step = (h >> 32) | 1;
+        count_type m = ~count_type(0);
+        for (size_t i = 0; i < depth_; ++i, h += step) {
+            count_type& c = cells[i * width_ + (h & (width_ - 1))];
+            m = std::min(m, c += n);
+        }
+        return m;
+    }
+
+    count_type estimate(size_t h) const {
+        size_t step = (h >> 32) | 1;
+        count_type m = ~count_type(0);
+        for (size_t i = 0; i < depth_; ++i, h += step)
+            m = std::min(m, cells[i * width_ + (h & (width_ - 1))]);
+        return m;
+    }
+
+    void track(const T& t, count_type c) {
+        auto i = index.find(t);
+        if (i != index.end()) {
+            heap[i->second].second = c;
+            sift_down(i->second);
+        } else if (heap.size() < capacity_) {
+            heap.emplace_back(t, c);
+            index[t] = heap.size() - 1;
+            sift_up(heap.size() - 1);
+        } else if (c > heap.front().second) {
+            index.erase(heap.front().first);
+            heap.front() = {t, c};
+            index[t] = 0;
+            sift_down(0);
+        }
+    }
+
+    void place(size_t i, std::pair<T, count_type> t) {
+        index[t.first] = i;
+        heap[i] = std::move(t);
+    }
+
+    void sift_up(size_t i) {
+        std::pair<T, count_type> t = std::move(heap[i]);
+        for (size_t p; i && heap[p = (i - 1) / 2].second > t.second; i = p)
+            place(i, std::move(heap[p]));
+        place(i, std::move(t));
+    }
+
+    void sift_down(size_t i) {
+        std::pair<T, count_type> t = std::move(heap[i]);
+        for (size_t c; (c = 2 * i + 1) < heap.size(); i = c) {
+            if (c + 1 < heap.size() && heap[c + 1].second < heap[c].second) ++c;
+            if (heap[c].second >= t.second) break;
+            place(i, std::move(heap[c]));
+        }
+        place(i, std::move(t));
+    }
+};
+
+//-----Serialization-----
+template<class T, class = void>
+struct is_less_comparable : std::false_type {};
+
+template<class T>
+struct is_less_comparable<T, std::void_t<decltype(
+        std::declval<const T&>() < std::declval<const T&>())>>
+    : std::true_type {};
+
+// Encoding of single keys and values for dump and load. Integers are written
+// as LEB128 varints, zigzag encoded when signed, strings as a varint length
+// followed by their bytes, other trivially copyable types as their bytes in
+// the native byte order.
+struct binary_codec {
+    static void put_varint(std::ostream& os, uint64_t v) {
+        char b[10];
+        int n = 0;
+        do b[n++] = char((v & 0x7f) | (v > 0x7f ? 0x80 : 0)); while (v >>= 7);
+        os.write(b, n);
+    }
+
+    static uint64_t get_varint(std::istream& is) {
+        uint64_t v = 0;
+        for (int s = 0; s < 64; s += 7) {
+            int c = is.get();
+            if (c == std::char_traits<char>::eof())
+                throw std::runtime_error("load: truncated input");
+            v |= uint64_t(c & 0x7f) << s;
+            if (!(c & 0x80)) return v;
+        }
+        throw std::runtime_error("load: malformed varint");
+    }
+
+    template<class V>
+    static void put(std::ostream& os, const V& v) {
+        if constexpr (is_saturating<V>::value) {
+            put(os, v.v);
+        } else if constexpr (std::is_integral<V>::value) {
+            if constexpr (std::is_signed<V>::value)
+                put_varint(os, uint64_t(static_cast<long long>(v)) << 1 ^
+                               uint64_t(static_cast<long long>(v) >> 63));
+            else
+                put_varint(os, uint64_t(v));
+        } else if constexpr (is_string<V>::value) {
+            put_varint(os, v.size());
+            os.write(v.data(), std::streamsize(v.size()));
+        } else {
+            static_assert(std::is_trivially_copyable<V>::value,
+                          "no binary encoding for this type");
+            os.write(reinterpret_cast<const char*>(&v), sizeof v);
+        }
+    }
+
+    template<class V>
+    static void get(std::istream& is, V& v) {
+        if constexpr (is_saturating<V>::value) {
+            get(is, v.v);
+        } else if constexpr (std::is_integral<V>::value) {
+            uint64_t u = get_varint(is);
+            if constexpr (std::is_signed<V>::value)
+                v = V(static_cast<long long>(u >> 1) ^
+                      -static_cast<long long>(u & 1));
+            else
+                v = V(u);
+        } else if constexpr (is_string<V>::value) {
+            // The bytes are read in chunks, the string growing as they
+            // arrive, so that a corrupt length fails on the missing bytes
+            // rather than on allocation.
+            uint64_t n = get_varint(is);
+            v.clear();
+            while (n) {
+                size_t k = size_t(std::min<uint64_t>(n, 1 << 16));
+                size_t at = v.size();
+                v.resize(at + k);
+                read(is, &v[at], k);
+                n -= k;
+            }
+        } else {
+            read(is, reinterpret_cast<char*>(&v), sizeof v);
+        }
+    }
+
+private:
+    template<class V> struct is_saturating : std::false_type {};
+    template<class U> struct is_saturating<saturating<U>> : std::true_type {};
+    template<class V> struct is_string : std::false_type {};
+    template<class A>
+    struct is_string<std::basic_string<char, std::char_traits<char>, A>>
+        : std::true_type {};
+
+    static void read(std::istream& is, char* p, size_t n) {
+        if (!is.read(p, std::streamsize(n)))
+            throw std::runtime_error("load: truncated input");
+    }
+};
+
+// Writes the entries of m, a Counter, defaultdict or any other map, sorted
+// by key when the keys are ordered. Sorted integer keys are written as the
+// difference from the previous one, so that dense keys take a byte each.
+template<class Map>
+void dump(std::ostream& os, const Map& m) {
+    typedef typename Map::key_type K;
+    std::vector<const typename Map::value_type*> v;
+    v.reserve(m.size());
+    for (auto &t : m) v.push_back(&t);
+    if constexpr (is_less_comparable<K>::value)
+        std::sort(v.begin(), v.end(), [](auto l, auto r) {
+            return l->first < r->first;
+        });
+    os.write("CLCT\1", 5);
+    binary_codec::put_varint(os, v.size());
+    for (size_t i = 0; i < v.size(); ++i) {
+        if constexpr (std::is_integral<K>::value) {
+            if (i) binary_codec::put_varint(os, uint64_t(v[i]->first) -
+                                                uint64_t(v[i - 1]->first));
+            else binary_codec::put(os, v[i]->first);
+        } else {
+            binary_codec::put(os, v[i]->first);
+        }
+        binary_codec::put(os, v[i]->second);
+    }
+}
+
+// Reads what dump wrote for a map of key type K and value type V, calling
+// start(n) with the number of entries to make room for and then f(k, v) on
+// each. The input may declare any number of entries, so room is made up
+// front for 64K of them at most, and for the others as they arrive.
+template<class K, class V, class S, class F>
+void load_entries(std::istream& is, S start, F f) {
+    char magic[5];
+    if (!is.read(magic, 5) || std::memcmp(magic, "CLCT\1", 5))
+        throw std::runtime_error("load: not a dumped map");
+    size_t n = size_t(binary_codec::get_varint(is));
+    start(std::min(n, size_t(1) << 16));
+    K k{};
+    for (size_t i = 0; i < n; ++i) {
+        if constexpr (std::is_integral<K>::value) {
+            if (i) k = K(uint64_t(k) + binary_codec::get_varint(is));
+            else binary_codec::get(is, k);
+        } else {
+            binary_codec::get(is, k);
+        }
+        V v;
+        binary_codec::get(is, v);
+        f(k, std::move(v));
+    }
+}
+
+// Replaces the contents of m with what dump wrote for a map of the same key
+// and value types. Throws std::runtime_error on malformed input.
+template<class Map>
+void load(std::istream& is, Map& m) {
+    typedef typename Map::key_type K;
+    typedef typename Map::mapped_type V;
+    load_entries<K, V>(is, [&](size_t n) { m.clear(); reserve_for(m, n); },
+                       [&](const K& k, V&& v) { m.emplace(k, std::move(v)); });
+}
+
+// Adds the counts that dump wrote, such as the changes returned by a
+// delta_counter's checkpoint(), to those of c, without building a map of
+// them first.
+template<class Map>
+void load_add(std::istream& is, Map& c) {
+    typedef typename Map::key_type K;
+    typedef typename Map::mapped_type V;
+    load_entries<K, V>(is, [&](size_t n) { reserve_for(c, c.size() + n); },
+                       [&](const K& k, V&& v) { c[k] += v; });
+}
+
+// Header of the files written by dump_mapped, followed by the sorted keys,
+// their counts, and the indices of the entries from the most common to the
+// least, each array aligned for its type.
+struct mapped_header {
+    char magic[4];
+    uint32_t byte_order;
+    uint32_t key_size, key_align, count_size, count_align;
+    uint64_t size;
+
+    static constexpr uint32_t native_order = 0x01020304;
+
+    static size_t align(size_t n, size_t a) { return (n + a - 1) / a * a; }
+    size_t keys() const { return align(sizeof(mapped_header), key_align); }
+    size_t counts() const {
+        return align(keys() + size * key_size, count_align);
+    }
+    size_t order() const { return align(counts() + size * count_size, 4); }
+    size_t end() const { return order() + size * 4; }
+
+    // Whether the arrays fit in len bytes, checked before computing end() so
+    // that no size or alignment read from a file can overflow it.
+    bool fits(size_t len) const {
+        uint64_t entry = uint64_t(key_size) + count_size + 4;
+        return key_align && count_align && key_align <= len &&
+               count_align <= len && size <= len / entry && end() <= len;
+    }
+};
+
+// Writes c in the layout that mapped_counter reads in place. Keys and counts
+// must be trivially copyable, and the file is only readable on machines of
+// the same byte order and type sizes.
+template<class T, class Map>
+void dump_mapped(std::ostream& os, const Counter<T, Map>& c) {
+    typedef typename Map::mapped_type C;
+    static_assert(std::is_trivially_copyable<T>::value &&
+                  std::is_trivially_copyable<C>::value &&
+                  is_less_comparable<T>::value,
+                  "dump_mapped needs ordered, trivially copyable keys");
+    if (c.size() > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("dump_mapped: too many entries");
+    std::vector<std::pair<T, C>> v(c.begin(), c.end());
+    std::sort(v.begin(), v.end(), [](const std::pair<T, C> &l,
+                                     const std::pair<T, C> &r) {
+                                         return l.first < r.first;
+                                     });
+    std::vector<uint32_t> order(v.size());
+    for (size_t i = 0; i < v.size(); ++i) order[i] = uint32_t(i);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t l, uint32_t r) {
+        return v[l].second > v[r].second;
+    });
+    mapped_header h = {{'C', 'L', 'C', 'M'}, mapped_header::native_order,
+                       sizeof(T), alignof(T), sizeof(C), alignof(C), v.size()};
+    size_t at = 0;
+    auto pad = [&](size_t to) {
+        for (; at < to; ++at) os.put('\0');
+    };
+    auto write = [&](const void* p, size_t n) {
+        os.write(static_cast<const char*>(p), std::streamsize(n));
+        at += n;
+    };
+    write(&h, sizeof h);
+    pad(h.keys());
+    for (auto &t : v) write(&t.first, sizeof(T));
+    pad(h.counts());
+    for (auto &t : v) write(&t.second, sizeof(C));
+    pad(h.order());
+    write(order.data(), order.size() * 4);
+}
+
+#if __has_include(<sys/mman.h>)
+// Read-only Counter over a file written by dump_mapped, mapped into memory
+// and read in place: opening it costs no parsing or copying whatever its
+// size, and pages are only read as lookups touch them. at and count binary
+// search the keys, most_common(n) reads the first n indices of the order
+// array, and throws std::runtime_error on one out of range. C must be the
+// count type of the dumped Counter.
+template<class T, class C = int>
+struct mapped_counter {
+    typedef C count_type;
+    typedef std::vector<std::pair<T, C>> item_vector;
+
+    // Throws std::system_error if the file cannot be mapped, and
+    // std::runtime_error if it was not written by dump_mapped for T and C.
+    explicit mapped_counter(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) fail_errno(path);
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            int e = errno;
+            ::close(fd);
+            errno = e;
+            fail_errno(path);
+        }
+        len = size_t(st.st_size);
+        if (len < sizeof(mapped_header)) {
+            ::close(fd);
+            throw std::runtime_error("mapped_counter: " + path +
+                                     " is not a mapped counter");
+        }
+        base = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+        int e = errno;
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            errno = e;
+            fail_errno(path);
+        }
+        const mapped_header& h = *static_cast<const mapped_header*>(base);
+        if (std::memcmp(h.magic, "CLCM", 4) ||
+            h.byte_order != mapped_header::native_order ||
+            h.key_size != sizeof(T) || h.key_align != alignof(T) ||
+            h.count_size != sizeof(C) || h.count_align != alignof(C) ||
+            !h.fits(len)) {
+            ::munmap(base, len);
+            throw std::runtime_error("mapped_counter: " + path +
+                                     " does not hold counts of this type");
+        }
+        const char* p = static_cast<const char*>(base);
+        n = size_t(h.size);
+        keys = reinterpret_cast<const T*>(p + h.keys());
+        counts = reinterpret_cast<const C*>(p + h.counts());
+        order = reinterpret_cast<const uint32_t*>(p + h.order());
+    }
+
+    mapped_counter(mapped_counter&& m) noexcept { swap(m); }
+    mapped_counter& operator=(mapped_counter m) noexcept {
+        swap(m);
+        return *this;
+    }
+    ~mapped_counter() { if (base) ::munmap(base, len); }
+
+    void swap(mapped_counter& m) noexcept {
+        std::swap(base, m.base), std::swap(len, m.len), std::swap(n, m.n);
+        std::swap(keys, m.keys), std::swap(counts, m.counts);
+        std::swap(order, m.order);
+    }
+
+    size_t size() const { return n; }
+    bool empty() const { return !n; }
+
+    const C& at(const T& t) const {
+        const T* k = std::lower_bound(keys, keys + n, t);
+        if (k == keys + n || t < *k)
+            throw std::out_of_range("mapped_counter::at");
+        return counts[k - keys];
+    }
+
+    C count(const T& t) const {
+        const T* k = std::lower_bound(keys, keys + n, t);
+        return k == keys + n || t < *k ? C() : counts[k - keys];
+    }
+
+    void most_common(item_vector& v, int m=0) const {
+        size_t k = m <= 0 ? n : std::min(size_t(m), n);
+        v.clear();
+        v.reserve(k);
+        for (size_t i = 0; i < k; ++i) {
+            if (order[i] >= n)
+                throw std::runtime_error("mapped_counter: corrupt order");
+            v.emplace_back(keys[order[i]], counts[order[i]]);
+        }
+    }
+
+    item_vector most_common(int m=0) const {
+        item_vector v;
+        most_common(v, m);
+        return v;
+    }
+
+    typename wide_count<C>::type total() const {
+        typename wide_count<C>::type s = 0;
+        for (size_t i = 0; i < n; ++i) s += counts[i];
+        return s;
+    }
+
+    struct Iter {
+        const mapped_counter* c;
+        size_t i;
+        C left;
+        Iter(const mapped_counter* c, size_t i) : c(c), i(i), left() { skip(); }
+        const T& operator*() const { return c->keys[i]; }
+        Iter& operator++() {
+            if (!(--left > 0)) ++i, skip();
+            return *this;
+        }
+        Iter operator++(int) {
+            Iter j = *this;
+            ++*this;
+            return j;
+        }
+        bool operator!=(const Iter &j) const { return i != j.i; }
+        void skip() {
+            while (i < c->n && !(c->counts[i] > 0)) ++i;
+            if (i < c->n) left = c->counts[i];
+        }
+    };
+
+    // Same as Counter::elements(), in key order.
+    range<Iter> elements() const { return {{this, 0}, {this, n}}; }
+
+private:
+    void* base = nullptr;
+    size_t len = 0, n = 0;
+    const T* keys = nullptr;
+    const C* counts = nullptr;
+    const uint32_t* order = nullptr;
+
+    [[noreturn]] static void fail_errno(const std::string& path) {
+        throw std::system_error(errno, std::generic_category(),
+                                "mapped_counter: " + path);
+    }
+};
+#endif
+
+//-----delta_counter-----
+// Counter that also keeps the changes to its counts since the last
+// checkpoint(), a count for every key written to, by how much, so that a
+// node ships those instead of its whole table. The changes are a Counter:
+// a central node sums them with Counter::merge_tree and adds them with +=,
+// or reads them off the wire with load_add after dump wrote them, sorted
+// and delta coded.
+template<class T, class Map = std::unordered_map<T, int>>
+struct delta_counter {
+    typedef Counter<T, Map> counter_type;
+    typedef typename counter_type::count_type count_type;
+
+    void increment(const T& t, count_type n = 1) {
+        c[t] += n;
+        d[t] += n;
+    }
+
+    delta_counter& update(std::initializer_list<T> l) {
+        return update(l.begin(), l.end());
+    }
+
+    template<class It>
+    delta_counter& update(It first, It last) {
+        for (; first != last; ++first) increment(*first);
+        return *this;
+    }
+
+    template<class M>
+    delta_counter& operator+=(const M &m) {
+        for (auto &t : m) increment(t.first, t.second);
+        return *this;
+    }
+
+    count_type count(const T& t) const {
+        auto i = c.find(t);
+        return i == c.end() ? count_type() : i->second;
+    }
+
+    size_t size() const { return c.size(); }
+    const counter_type& counts() const { return c; }
+    const counter_type& changes() const { return d; }
+
+    // Returns the changes since the last checkpoint, keeping the keys whose
+    // changes cancelled out, and starts afresh.
+    counter_type checkpoint() {
+        counter_type r;
+        r.swap(d);
+        return r;
+    }
+
+private:
+    counter_type c, d;
+};
+
+//-----Frozen maps-----
+// Kept out of line, so that the lookups calling it inline without the code
+// that throws.
+[[noreturn]] COLLECTIONS_COLD inline void throw_out_of_range(const char* what) {
+    throw std::out_of_range(what);
+}
+
+// Read only map of N entries fixed at compile time, such as the defaults at
+// the end of a chain, sorted by key in an array. Built in a constexpr
+// variable by make_const_table, it is static data, and find is evaluated at
+// compile time for constant keys, a binary search over the array otherwise.
+template<class K, class V, size_t N>
+struct const_table {
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef const value_type* const_iterator;
+    typedef const_iterator iterator;
+
+    std::array<value_type, N> items;
+
+    constexpr const_iterator begin() const { return items.data(); }
+    constexpr const_iterator end() const { return items.data() + N; }
+    constexpr size_t size() const { return N; }
+    constexpr bool empty() const { return !N; }
+
+    constexpr const_iterator find(const K& k) const {
+        size_t lo = 0, hi = N;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (items[mid].first < k) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < N && !(k < items[lo].first) ? begin() + lo : end();
+    }
+
+    constexpr size_t count(const K& k) const { return find(k) != end(); }
+
+    constexpr const V& at(const K& k) const {
+        auto i = find(k);
+        if (i == end()) throw_out_of_range("const_table::at: key not found");
+        return i->second;
+    }
+};
+
+template<class K, class V, size_t N, size_t... I>
+constexpr const_table<K, V, N> make_const_table(
+        const std::pair<K, V> (&entries)[N], std::index_sequence<I...>) {
+    size_t order[N] = {};
+    for (size_t i = 0; i < N; ++i) {
+        size_t j = i;
+        for (; j && entries[i].first < entries[order[j - 1]].first; --j)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    for (size_t i = 1; i < N; ++i)
+        if (!(entries[order[i - 1]].first < entries[order[i]].first))
+            throw std::invalid_argument("make_const_table: duplicate key");
+    return {{{std::pair<const K, V>(entries[order[I]])...}}};
+}
+
+// The const_table of the given entries, in any order. A duplicate key throws
+// std::invalid_argument, which fails the build in a constant expression.
+template<class K, class V, size_t N>
+constexpr const_table<K, V, N> make_const_table(
+        const std::pair<K, V> (&entries)[N]) {
+    return make_const_table(entries, std::make_index_sequence<N>());
+}
+
+// Read only hash map of the entries of another map, in an array of exactly
+// as many slots as entries placed by a minimal perfect hash. Keys fall into
+// buckets of about 3, and each bucket has a seed that sends its keys to
+// distinct slots, or directly the slot of its only key. A lookup hashes the
+// key once, reads a seed and compares a single key. Building takes expected
+// linear time, and throws std::invalid_argument on two keys with the same
+// hash, which no seed separates.
+template<class K, class V, class Hash = std::hash<K>,
+         class Eq = std::equal_to<K>>
+struct frozen_map {
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef Hash hasher;
+    typedef Eq key_equal;
+    typedef const value_type* const_iterator;
+    typedef const_iterator iterator;
+
+    frozen_map() = default;
+    template<class It>
+    frozen_map(It first, It last, const Hash& hash = Hash(),
+               const Eq& eq = Eq()) : hash_(hash), eq_(eq) {
+        build(std::vector<std::pair<K, V>>(first, last));
+    }
+
+    const_iterator begin() const { return slots_.data(); }
+    const_iterator end() const { return slots_.data() + slots_.size(); }
+    size_t size() const { return slots_.size(); }
+    bool empty() const { return slots_.empty(); }
+    hasher hash_function() const { return hash_; }
+    key_equal key_eq() const { return eq_; }
+
+    const_iterator find(const K& k) const { return lookup(k); }
+    size_t count(const K& k) const { return lookup(k) != end(); }
+    const V& at(const K& k) const {
+        auto i = lookup(k);
+        if (i == end()) throw_out_of_range("frozen_map::at: key not found");
+        return i->second;
+    }
+
+    // With a transparent Hash and Eq, keys are also looked up as any type
+    // they hash and compare with.
+    template<class Q, class H = Hash, class E = Eq,
+             class = typename H::is_transparent,
+             class = typename E::is_transparent>
+    const_iterator find(const Q& k) const { return lookup(k); }
+    template<class Q, class H = Hash, class E = Eq,
+             class = typename H::is_transparent,
+             class = typename E::is_transparent>
+    size_t count(const Q& k) const { return lookup(k) != end(); }
+    template<class Q, class H = Hash, class E = Eq,
+             class = typename H::is_transparent,
+             class = typename E::is_transparent>
+    const V& at(const Q& k) const {
+        auto i = lookup(k);
+        if (i == end()) throw_out_of_range("frozen_map::at: key not found");
+        return i->second;
+    }
+
+private:
+    // A seed with this bit set holds the slot of the only key of its bucket.
+    static constexpr uint32_t direct = uint32_t(1) << 31;
+
+    std::vector<uint32_t> seeds_ = std::vector<uint32_t>(1);
+    std::vector<value_type> slots_;
+    Hash hash_;
+    Eq eq_;
+
+    template<class Q>
+    uint64_t hash(const Q& k) const {
+        uint64_t h = hash_(k);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        return h ^ (h >> 33);
+    }
+
+    // x scaled to [0, n) by the high half of a product, without a division.
+    static size_t reduce(uint32_t x, size_t n) {
+        return static_cast<size_t>((uint64_t(x) * n) >> 32);
+    }
+
+    size_t bucket(uint64_t h) const {
+        return reduce(uint32_t(h >> 32), seeds_.size());
+    }
+
+    static size_t slot(uint64_t h, uint32_t seed, size_t n) {
+        uint64_t x = h ^ (seed * 0x9e3779b97f4a7c15ULL);
+        x ^= x >> 32;
+        x *= 0xd6e8feb86659fd93ULL;
+        return seed & direct ? seed & ~direct : reduce(uint32_t(x >> 32), n);
+    }
+
+    template<class Q>
+    const_iterator lookup(const Q& k) const {
+        if (slots_.empty()) return end();
+        uint64_t h = hash(k);
+        size_t i = slot(h, seeds_[bucket(h)], slots_.size());
+        return eq_(slots_[i].first, k) ? begin() + i : end();
+    }
+
+    // Buckets are seeded from the largest down, while most slots are free,
+    // and the buckets of one key take the slots left over.
+    void build(std::vector<std::pair<K, V>> in) {
+        size_t n = in.size();
+        if (n >= direct) throw std::length_error("frozen_map: too many keys");
+        size_t nb = std::max<size_t>(1, (n + 2) / 3);
+        seeds_.assign(nb, 0);
+        std::vector<uint64_t> hs(n);
+        std::vector<uint32_t> start(nb + 1), keys(n);
+        for (size_t i = 0; i < n; ++i) {
+            hs[i] = hash(in[i].first);
+            ++start[bucket(hs[i]) + 1];
+        }
+        for (size_t b = 0; b < nb; ++b) start[b + 1] += start[b];
+        std::vector<uint32_t> next(start.begin(), start.end() - 1);
+        for (size_t i = 0; i < n; ++i) keys[next[bucket(hs[i])]++] = i;
+
+        std::vector<uint32_t> order(nb);
+        for (size_t b = 0; b < nb; ++b) order[b] = b;
+        auto size = [&](uint32_t b) { return start[b + 1] - start[b]; };
+        std::stable_sort(order.begin(), order.end(),
+                         [&](uint32_t a, uint32_t b) {
+                             return size(a) > size(b);
+                         });
+
+        std::vector<uint32_t> pos(n), tried;
+        std::vector<char> taken(n);
+        size_t free = 0;
+        for (uint32_t b : order) {
+            if (!size(b)) break;
+            uint32_t *lo = keys.data() + start[b], *hi = lo + size(b);
+            if (hi - lo == 1) {
+                while (taken[free]) ++free;
+                seeds_[b] = direct | free;
+                taken[free] = 1, pos[free] = *lo;
+                continue;
+            }
+            std::sort(lo, hi,
+                      [&](uint32_t x, uint32_t y) { return hs[x] < hs[y]; });
+            for (uint32_t* k = lo + 1; k < hi; ++k)
+                if (hs[k[-1]] == hs[*k])
+                    throw std::invalid_argument("frozen_map: equal hashes");
+            for (uint32_t seed = 0;; ++seed) {
+                if (seed == direct)
+                    throw std::invalid_argument("frozen_map: no seed found");
+                tried.clear();
+                for (uint32_t* k = lo; k < hi; ++k) {
+                    size_t s = slot(hs[*k], seed, n);
+                    if (taken[s]) break;
+                    taken[s] = 1;
+                    tried.push_back(s);
+                }
+                if (tried.size() == size_t(hi - lo)) {
+                    seeds_[b] = seed;
+                    for (size_t j = 0; j < tried.size(); ++j)
+                        pos[tried[j]] = lo[j];
+                    break;
+                }
+                for (uint32_t s : tried) taken[s] = 0;
+            }
+        }
+        slots_.reserve(n);
+        for (size_t i = 0; i < n; ++i)
+            slots_.emplace_back(std::move(in[pos[i]].first),
+                                std::move(in[pos[i]].second));
+    }
+};
+
+// Read only ordered map of the entries of another map, stored in Eytzinger
+// order: the binary search tree over the sorted keys laid out breadth
+// first, the children of entry i at 2i + 1 and 2i + 2. A search descends
+// without branching on the comparisons, and its first steps share a few
+// cache lines for all keys. Iteration follows that layout, not key order.
+template<class K, class V, class Compare = std::less<K>>
+struct eytzinger_map {
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef Compare key_compare;
+    typedef const value_type* const_iterator;
+    typedef const_iterator iterator;
+
+    eytzinger_map() = default;
+    // Of equivalent keys, the first one is kept.
+    template<class It>
+    eytzinger_map(It first, It last, const Compare& comp = Compare()) :
+            comp_(comp) {
+        std::vector<std::pair<K, V>> in(first, last);
+        auto less = [this](const auto& a, const auto& b) {
+            return comp_(a.first, b.first);
+        };
+        std::stable_sort(in.begin(), in.end(), less);
+        in.erase(std::unique(in.begin(), in.end(),
+                             [&](const auto& a, const auto& b) {
+                                 return !less(a, b);
+                             }),
+                 in.end());
+        std::vector<size_t> order(in.size());
+        size_t next = 0;
+        layout(order, 1, next);
+        items_.reserve(in.size());
+        for (size_t i : order)
+            items_.emplace_back(std::move(in[i].first),
+                                std::move(in[i].second));
+    }
+
+    const_iterator begin() const { return items_.data(); }
+    const_iterator end() const { return items_.data() + items_.size(); }
+    size_t size() const { return items_.size(); }
+    bool empty() const { return items_.empty(); }
+    key_compare key_comp() const { return comp_; }
+
+    const_iterator find(const K& k) const { return lookup(k); }
+    size_t count(const K& k) const { return lookup(k) != end(); }
+    const V& at(const K& k) const {
+        auto i = lookup(k);
+        if (i == end()) throw_out_of_range("eytzinger_map::at: key not found");
+        return i->second;
+    }
+
+    template<class Q, class C = Compare, class = typename C::is_transparent>
+    const_iterator find(const Q& k) const { return lookup(k); }
+    template<class Q, class C = Compare, class = typename C::is_transparent>
+    size_t count(const Q& k) const { return lookup(k) != end(); }
+    template<class Q, class C = Compare, class = typename C::is_transparent>
+    const V& at(const Q& k) const {
+        auto i = lookup(k);
+        if (i == end()) throw_out_of_range("eytzinger_map::at: key not found");
+        return i->second;
+    }
+
+private:
+    std::vector<value_type> items_;
+    Compare comp_;
+
+    // Numbers the entries of the subtree at node i, counted from 1, in key
+    // order.
+    void layout(std::vector<size_t>& order, size_t i, size_t& next) {
+        if (i > order.size()) return;
+        layout(order, 2 * i, next);
+        order[i - 1] = next++;
+        layout(order, 2 * i + 1, next);
+    }
+
+    // Descendants a few levels down that fit in a cache line together.
+    static constexpr size_t ahead = sizeof(value_type) >= 32 ? 2 :
+                                    sizeof(value_type) >= 16 ? 4 :
+                                    sizeof(value_type) >= 8 ? 8 : 16;
+
+    // The descent goes right past every key less than k, and the node the
+    // search stopped going left at is the first key not less than k: the
+    // path ends in a run of right turns, shifted out of i. Past the size of
+    // a typical L2 cache, the descendants of the next levels are fetched
+    // while the current one is compared.
+    template<class Q>
+    const_iterator lookup(const Q& k) const {
+        size_t n = items_.size(), i = 1;
+        if (n * sizeof(value_type) > (size_t(256) << 10)) {
+            while (i <= n) {
+#ifdef __GNUC__
+                __builtin_prefetch(items_.data() + ahead * i - 1);
+#endif
+                i = 2 * i + comp_(items_[i - 1].first, k);
+            }
+        } else {
+            while (i <= n) i = 2 * i + comp_(items_[i - 1].first, k);
+        }
+#ifdef __GNUC__
+        i >>= __builtin_ffsll(static_cast<long long>(~i));
+#else
+        while (i & 1) i >>= 1;
+        i >>= 1;
+#endif
+        return i && !comp_(k, items_[i - 1].first) ? begin() + (i - 1) : end();
+    }
+};
+
+// An immutable copy of m, a Counter, defaultdict, std::map or any other
+// map, to serve lookups that never change, such as the last maps of a
+// chain: an eytzinger_map with the compare of m if m is ordered, a
+// frozen_map with its hash and equality otherwise.
+template<class Map>
+auto freeze(const Map& m) {
+    typedef typename Map::key_type K;
+    typedef typename Map::mapped_type V;
+    if constexpr (is_ordered_map<Map>::value)
+        return eytzinger_map<K, V, typename Map::key_compare>(
+                m.begin(), m.end(), m.key_comp());
+    else
+        return frozen_map<K, V, typename Map::hasher, typename Map::key_equal>(
+                m.begin(), m.end(), m.hash_function(), m.key_eq());
+}
+
+//-----ChainMap-----
+template<class CM>
+struct cached_chainmap;
+
+// k as the chain CM looks it up: as it is if every map of CM accepts it,
+// converted to CM::K once for the whole chain otherwise.
+template<class CM, class Q>
+decltype(auto) chain_key(const Q& k) {
+    if constexpr (CM::transparent || std::is_same<Q, typename CM::K>::value)
+        return (k);
+    else
+        return typename CM::K(k);
+}
+
+// Reference to the value of a key in whichever map of a chain holds it. It
+// is read in place; only a write copies the value into the first map. A
+// write looks the key up again, so it sees the changes made to the chain
+// since the reference was taken.
+template<class CM>
+struct chain_ref {
+    typedef typename CM::K K;
+    typedef typename CM::V V;
+
+    chain_ref(CM& cm, const K& k, const std::pair<const K, V>* e) :
+            cm(cm), key(k), v(e ? &e->second : nullptr) {}
+    chain_ref(const chain_ref&) = delete;
+    chain_ref& operator=(const chain_ref&) = delete;
+
+    explicit operator bool() const { return v; }
+
+    const V& get() const {
+        if (!v) throw std::out_of_range("chain_ref::get: key not found");
+        return *v;
+    }
+    operator const V&() const { return get(); }
+
+    // The value in the first map, copied there from its owner if needed.
+    V& mut() {
+        V& x = cm[key];
+        v = &x;
+        return x;
+    }
+
+    chain_ref& operator=(const V& x) {
+        V& y = cm.emplace_front(key, x);
+        y = x;
+        v = &y;
+        return *this;
+    }
+
+private:
+    CM& cm;
+    K key;
+    const V* v;
+};
+
+template<class Map, class... Maps>
+struct ChainMap : ChainMap<Maps...> {
+    typedef typename Map::key_type K;
+    typedef typename Map::mapped_type V;
+    typedef ChainMap<Maps...> B;
+
+    Map& map;
+
+    ChainMap(Map& map, Maps&... maps) : B(maps...), map(map) {}
+    ChainMap(Map& map, const B& cmp) : B(cmp), map(map) {}
+
+    Map& get_map(size_t i) { return i ? B::get_map(i - 1) : map; }
+
+    template<class NewMap>
+    ChainMap<NewMap, Map, Maps...> new_child(NewMap& new_map) {
+        return {new_map, *this};
+    }
+
+    // Visits the first map, then the rest of the chain skipping the keys of
+    // the first map, so every key is seen once along with its value as
+    // returned by at().
+    struct const_iterator {
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const K, V> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const ChainMap* cm;
+        typename Map::const_iterator i;
+        typename B::const_iterator rest;
+
+        reference operator*() const {
+            return i != std::as_const(cm->map).end() ? *i : *rest;
+        }
+        pointer operator->() const { return &**this; }
+        const_iterator& operator++() {
+            if (i != std::as_const(cm->map).end()) ++i;
+            else ++rest;
+            skip();
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator t = *this;
+            ++*this;
+            return t;
+        }
+        bool operator==(const const_iterator& o) const {
+            return i == o.i && rest == o.rest;
+        }
+        bool operator!=(const const_iterator& o) const { return !(*this == o); }
+
+        void skip() {
+            const Map& m = cm->map;
+            if (i != m.end()) return;
+            auto e = cm->B::end();
+            while (rest != e && m.find(rest->first) != m.end()) ++rest;
+        }
+    };
+
+    const_iterator begin() const {
+        const_iterator i{this, std::as_const(map).begin(), B::begin()};
+        i.skip();
+        return i;
+    }
+    const_iterator end() const {
+        return {this, std::as_const(map).end(), B::end()};
+    }
+
+    // Whether all maps look up other types than K, such as std::string_view
+    // for std::string with a transparent hash or compare. Keys of another
+    // type are converted to K once first if not.
+    static constexpr bool transparent =
+            is_transparent_map<Map>::value && B::transparent;
+
+    static constexpr size_t depth = sizeof...(Maps) + 1;
+
+    // The I-th map, resolved at compile time.
+    template<size_t I>
+    auto& level() const {
+        if constexpr (I == 0) return map;
+        else return B::template level<I - 1>();
+    }
+
+    // Expands into one find per map, the first expected to hit, rather than
+    // a call per map through the bases.
+    template<class Q = K, class S = no_stats>
+    const std::pair<const K, V>* find_item(const Q& q, S&& stats = S()) const {
+        return find_levels(chain_key<ChainMap>(q), stats,
+                           std::make_index_sequence<depth>());
+    }
+
+    template<class Q = K>
+    const V* find(const Q& k) const {
+        auto e = find_item(k);
+        return e ? &e->second : nullptr;
+    }
+
+    // Same as find, recording in stats, such as a lookup_stats, the depth
+    // at which k was found or that it was not.
+    template<class Q = K, class S>
+    const V* find(const Q& k, S& stats) const {
+        auto e = find_item(k, stats);
+        return e ? &e->second : nullptr;
+    }
+
+    chain_ref<ChainMap> ref(const K& k) {
+        auto i = map.find(k);
+        if (i != map.end()) return {*this, k, &*i};
+        return {*this, k, B::find_item(k)};
+    }
+
+    template<class Q = K>
+    const V& at(const Q& k) const {
+        if (const V* v = find(k)) return *v;
+        throw_out_of_range("ChainMap::at: key not found");
+    }
+
+    template<class Q = K>
+    V& operator[](const Q& q) {
+        const auto& k = chain_key<ChainMap>(q);
+        auto i = map.find(k);
+        if (i != map.end()) return i->second;
+        if (const V* v = B::find(k))
+            return find_or_emplace(map, k, *v).first->second;
+        return find_or_emplace(map, k).first->second;
+    }
+
+    template<class... Args>
+    V& emplace_front(const K& k, Args&&... args) {
+        return map.try_emplace(k, std::forward<Args>(args)...).first->second;
+    }
+
+    size_t erase(const K& k) { return map.erase(k); }
+
+    // Calls f on every map, from the first to the last.
+    template<class F>
+    void for_each_map(F&& f) {
+        f(map);
+        B::for_each_map(f);
+    }
+
+    cached_chainmap<ChainMap> cached() const;
+
+    void one_map(Map& one) {
+        one.insert(map.begin(), map.end());
+        B::one_map(one);
+    }
+
+    // The result uses the allocator of the first map.
+    Map one_map() {
+        Map one(map.get_allocator());
+        one_map(one);
+        return one;
+    }
+
+private:
+    template<class Q, class S, size_t... I>
+    const std::pair<const K, V>* find_levels(const Q& k, S& stats,
+                                             std::index_sequence<0, I...>)
+            const {
+        auto i = map.find(k);
+        if (COLLECTIONS_LIKELY(i != map.end())) {
+            stats.chain_hit(0);
+            return &*i;
+        }
+        const std::pair<const K, V>* e = nullptr;
+        if ((... || (e = find_level<I>(k, stats)))) return e;
+        stats.chain_miss();
+        return nullptr;
+    }
+
+    template<size_t I, class Q, class S>
+    const std::pair<const K, V>* find_level(const Q& k, S& stats) const {
+        auto& m = level<I>();
+        auto i = m.find(k);
+        if (i == m.end()) return nullptr;
+        stats.chain_hit(I);
+        return &*i;
+    }
+};
+
+template<class Map>
+struct ChainMap<Map> {
+    typedef typename Map::key_type K;
+    typedef typename Map::mapped_type V;
+
+    Map& map;
+
+    ChainMap(Map& map) : map(map) {}
+
+    Map& get_map(size_t i) {
+        if (i) throw std::out_of_range("ChainMap::get_map: index out of range");
+        return map;
+    }
+
+    template<class NewMap>
+    ChainMap<NewMap, Map> new_child(NewMap& new_map) { return {new_map, map}; }
 
-template<class Iter>
-struct range {
-    Iter b, e;
-    Iter begin() { return b; }
-    Iter end() { return e; }
-};
+    typedef typename Map::const_iterator const_iterator;
 
-//-----defaultdict-----
-template<class K, class V>
-struct defaultdict : std::unordered_map<K, V> {
-    V (*f)();
+    const_iterator begin() const { return std::as_const(map).begin(); }
+    const_iterator end() const { return std::as_const(map).end(); }
 
-    defaultdict(V (*f)()) : f(f) {}
-    defaultdict(V (*f)(), std::initializer_list<std::pair<const K, V>> il) :
-            f(f), std::unordered_map<K, V>(il) {}
+    static constexpr bool transparent = is_transparent_map<Map>::value;
 
-    V& operator[](const K& k) {
-        try { return std::unordered_map<K, V>::at(k); }
-        catch (const std::out_of_range &) {
-            return std::unordered_map<K, V>::operator[](k) = f();
-        }
+    static constexpr size_t depth = 1;
+
+    template<size_t I>
+    Map& level() const {
+        static_assert(I == 0, "ChainMap::level: index out of range");
+        return map;
     }
 
-    V& at(const K& k) { return (*this)[k]; }
+    template<class Q = K, class S = no_stats>
+    const std::pair<const K, V>* find_item(const Q& k, S&& stats = S()) const {
+        auto i = map.find(chain_key<ChainMap>(k));
+        if (i == map.end()) return stats.chain_miss(), nullptr;
+        stats.chain_hit(0);
+        return &*i;
+    }
+
+    template<class Q = K>
+    const V* find(const Q& k) const {
+        auto e = find_item(k);
+        return e ? &e->second : nullptr;
+    }
+
+    template<class Q = K, class S>
+    const V* find(const Q& k, S& stats) const {
+        auto e = find_item(k, stats);
+        return e ? &e->second : nullptr;
+    }
+
+    chain_ref<ChainMap> ref(const K& k) {
+        auto i = map.find(k);
+        return {*this, k, i != map.end() ? &*i : nullptr};
+    }
+
+    template<class Q = K>
+    const V& at(const Q& k) const {
+        if (const V* v = find(k)) return *v;
+        throw_out_of_range("ChainMap::at: key not found");
+    }
+
+    template<class Q = K>
+    V& operator[](const Q& k) {
+        return find_or_emplace(map, chain_key<ChainMap>(k)).first->second;
+    }
+
+    template<class... Args>
+    V& emplace_front(const K& k, Args&&... args) {
+        return map.try_emplace(k, std::forward<Args>(args)...).first->second;
+    }
+
+    size_t erase(const K& k) { return map.erase(k); }
+
+    template<class F>
+    void for_each_map(F&& f) { f(map); }
+
+    cached_chainmap<ChainMap> cached() const;
+
+    void one_map(Map& one) { one.insert(map.begin(), map.end()); }
+
+    Map one_map() { return Map(map, map.get_allocator()); }
 };
 
-//-----Counter-----
-template<class T>
-struct Counter : std::unordered_map<T, int> {
-    typedef typename std::unordered_map<T, int>::iterator iterator;
-    typedef typename std::unordered_map<T, int>::value_type value_type;
+//-----cached_chainmap-----
+template<class K, class = void>
+struct is_hashable : std::false_type {};
 
-    Counter(std::initializer_list<std::pair<const T, int>> il) :
-            std::unordered_map<T, int>(il) {}
-    Counter() = default;
+template<class K>
+struct is_hashable<K, std::void_t<decltype(std::hash<K>()(std::declval<K>()))>>
+        : std::true_type {};
 
-    struct Iter {
-        iterator curr, end;
-        int count;
-        Iter(iterator i, iterator e) : curr(i), end(e),
-                                       count(i == e ? 0 : i->second) {}
-        const T& operator*() { return curr->first; }
-        Iter& operator++() {
-            --count;
-            while (count <= 0 && ++curr != end)
-                count = curr->second;
-            return *this;
-        }
-        Iter operator++(int) {
-            Iter i = *this;
-            ++*this;
-            return i;
+// Whether M keeps references to its values on insertion: not flat_map and
+// the maps built on it, which move their entries when they grow.
+template<class... A>
+std::false_type keeps_references_test(const flat_map<A...>*);
+std::true_type keeps_references_test(const void*);
+
+template<class M>
+struct keeps_references
+    : decltype(keeps_references_test(std::declval<M*>())) {};
+
+// View of a ChainMap that indexes every key once, pointing it at the value in
+// the map that owns it, so that a lookup takes a single probe however deep
+// the chain is. Writes through the view patch the index. Handing out a map
+// with get_map bumps the version, which rebuilds the index on the next
+// lookup; so does invalidate(), for maps changed behind the view's back.
+// So does a write that inserts into a first map that moves its entries, as
+// a flat_map does when it grows and a clock_map when it evicts, which would
+// leave the index dangling.
+template<class CM>
+struct cached_chainmap {
+    typedef typename CM::K K;
+    typedef typename CM::V V;
+    typedef std::conditional_t<is_hashable<K>::value,
+                               std::unordered_map<K, const V*>,
+                               std::map<K, const V*>> index_type;
+
+    explicit cached_chainmap(const CM& chain) : chain(chain) {}
+
+    auto& get_map(size_t i) {
+        ++version;
+        return chain.get_map(i);
+    }
+
+    void invalidate() { ++version; }
+
+    const V* find(const K& k) const {
+        const index_type& idx = index();
+        auto i = idx.find(k);
+        return i != idx.end() ? i->second : nullptr;
+    }
+
+    const V& at(const K& k) const {
+        if (const V* v = find(k)) return *v;
+        throw std::out_of_range("cached_chainmap::at: key not found");
+    }
+
+    V& operator[](const K& k) {
+        typedef std::remove_reference_t<decltype(chain.get_map(0))> Front;
+        if constexpr (!keeps_references<Front>::value) {
+            const Front& front = chain.get_map(0);
+            if (front.find(k) == front.end()) ++version;
+            return chain[k];
+        } else {
+            V& v = chain[k];
+            if (built == version) idx[k] = &v;
+            return v;
         }
-        bool operator!=(const Iter &i) { return curr != i.curr; }
-    };
+    }
 
-    range<Iter> elements() {
-        iterator i = this->begin(), j = this->end();
-        while (i != j && i->second <= 0) ++i;
-        return {{i, j}, {j, j}};
+    size_t erase(const K& k) {
+        size_t n = chain.erase(k);
+        if (n && built == version) {
+            if (const V* v = chain.find(k)) idx[k] = v;
+            else idx.erase(k);
+        }
+        return n;
     }
 
-    std::vector<std::pair<T, int>> most_common(int n=0) {
-        if (n == 0) n = this->size();
-        std::vector<std::pair<T, int>> v(this->begin(), this->end());
-        std::function cmp = [](const std::pair<T, int> &l,
-                               const std::pair<T, int> &r) {
-                                   return l.second < r.second;
-                               };
-        std::make_heap(v.begin(), v.end(), cmp);
-        for (int i = 0; i < n; ++i) std::pop_heap(v.begin(), v.end() - i, cmp);
-        return {std::reverse_iterator(v.end()),
-                std::reverse_iterator(v.end() - n)};
+    auto one_map() { return chain.one_map(); }
+
+private:
+    CM chain;
+    mutable index_type idx;
+    mutable size_t version = 0, built = size_t(-1);
+
+    const index_type& index() const {
+        if (built == version) return idx;
+        idx.clear();
+        const_cast<CM&>(chain).for_each_map([this](auto& m) {
+            for (auto &t : m) idx.try_emplace(t.first, &t.second);
+        });
+        built = version;
+        return idx;
     }
+};
 
-    int& at(const T& t) = delete;
+template<class Map, class... Maps>
+cached_chainmap<ChainMap<Map, Maps...>> ChainMap<Map, Maps...>::cached() const {
+    return cached_chainmap<ChainMap>(*this);
+}
 
-    Counter& update(std::initializer_list<T> l) {
-        for (const T& t : l) ++(*this)[t];
+template<class Map>
+cached_chainmap<ChainMap<Map>> ChainMap<Map>::cached() const {
+    return cached_chainmap<ChainMap>(*this);
+}
+
+//-----dynamic_chainmap-----
+// Vector of trivially copyable values, stored inline up to N of them.
+template<class T, size_t N>
+struct small_vector {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "small_vector only holds trivially copyable values");
+
+    small_vector() = default;
+    small_vector(const small_vector& v) { *this = v; }
+    small_vector& operator=(const small_vector& v) {
+        if (this == &v) return *this;
+        size_ = 0;
+        reserve(v.size_);
+        std::copy(v.begin(), v.end(), data_);
+        size_ = v.size_;
         return *this;
     }
 
-    Counter& operator+=(const Counter &c) {
-        for (auto &t : c) (*this)[t.first] += t.second;
-        return *this;
+    T* begin() { return data_; }
+    T* end() { return data_ + size_; }
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+    size_t size() const { return size_; }
+    bool empty() const { return !size_; }
+    T& operator[](size_t i) { return data_[i]; }
+    const T& operator[](size_t i) const { return data_[i]; }
+    T& back() { return data_[size_ - 1]; }
+    const T& back() const { return data_[size_ - 1]; }
+
+    void push_back(const T& t) {
+        if (size_ == cap_) reserve(2 * cap_);
+        data_[size_++] = t;
     }
+    void pop_back() { --size_; }
 
-    Counter& operator-=(const Counter &c) {
-        for (auto &t : c) (*this)[t.first] -= t.second;
-        return *this;
+    void reserve(size_t n) {
+        if (n <= cap_) return;
+        std::unique_ptr<T[]> p(new T[n]);
+        std::copy(begin(), end(), p.get());
+        heap_ = std::move(p);
+        data_ = heap_.get(), cap_ = n;
     }
 
-    Counter operator+(const Counter &c) {
-        Counter ct = *this;
-        return ct += c;
+private:
+    T buf_[N];
+    T* data_ = buf_;
+    size_t size_ = 0, cap_ = N;
+    std::unique_ptr<T[]> heap_;
+};
+
+// Filter policy of dynamic_chainmap that keeps no filter.
+struct no_filter {
+    template<class K>
+    static size_t hash(const K&) { return 0; }
+    bool may_contain(size_t) const { return true; }
+    bool insert(size_t) { return true; }
+    template<class Map>
+    void rebuild(const Map&) {}
+};
+
+// Blocked Bloom filter: each key sets 4 bits of a single 64 bit word, so a
+// query reads one word. It keeps 16 to 32 bits per key, and answers "maybe"
+// for about 0.55% of absent keys at 16. Erased keys are not removed and only
+// cost a wasted probe. insert() returns false once more keys than it was
+// built for went in, when it is due for a rebuild.
+template<class K, class Hash = std::hash<K>>
+struct bloom_filter {
+    template<class Q>
+    static size_t hash(const Q& k) {
+        uint64_t h = Hash()(k);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        return static_cast<size_t>(h ^ (h >> 33));
     }
 
-    Counter operator-(const Counter &c) {
-        Counter ct = *this;
-        return ct -= c;
+    bool may_contain(size_t h) const {
+        uint64_t m = bits(h);
+        return (words[h & mask] & m) == m;
     }
 
-    int total() { 
-        int s = 0;
-        for (auto &t : *this) s += t.second;
-        return s;
+    bool insert(size_t h) {
+        words[h & mask] |= bits(h);
+        return ++n <= capacity;
+    }
+
+    template<class Map>
+    void rebuild(const Map& map) {
+        size_t w = 1;
+        while (w * 4 < map.size()) w *= 2;
+        words.assign(w, 0);
+        mask = w - 1, capacity = w * 4, n = 0;
+        for (auto &t : map) insert(hash(t.first));
+    }
+
+private:
+    std::vector<uint64_t> words = std::vector<uint64_t>(1);
+    size_t mask = 0, capacity = 4, n = 0;
+
+    static uint64_t bits(size_t h) {
+        uint64_t x = uint64_t(h) >> 32;
+        return uint64_t(1) << (x & 63) | uint64_t(1) << (x >> 6 & 63) |
+               uint64_t(1) << (x >> 12 & 63) | uint64_t(1) << (x >> 18 & 63);
     }
 };
 
-//-----ChainMap-----
-template<class Map, class... Maps>
-struct ChainMap : ChainMap<Maps...> {
+// ChainMap of any number of maps of the same type, decided at run time. The
+// maps are kept as pointers, the first map last, so that push_child,
+// pop_child and get_map take O(1) and lookups are a plain loop. With a
+// bloom_filter as Filter, every map gets a filter that lets lookups skip
+// the maps that cannot hold the key. Copies of a chain, such as those of
+// new_child and cached, share the filters of the maps they share, so that
+// inserts through any of them update it; maps changed through get_map, or
+// through a chain built apart, need rebuild_filter. With lookup_stats as
+// Stats, lookups count the depth they stop at and the maps filtered out.
+template<class Map, class Filter = no_filter, class Stats = no_stats>
+struct dynamic_chainmap {
     typedef typename Map::key_type K;
     typedef typename Map::mapped_type V;
-    typedef ChainMap<Maps...> B;
 
-    Map& map;
+    dynamic_chainmap() = default;
+    template<class... Maps>
+    explicit dynamic_chainmap(Map& map, Maps&... maps) {
+        Map* ms[] = {&map, &maps...};
+        levels.reserve(sizeof...(Maps) + 1);
+        for (size_t i = sizeof...(Maps) + 1; i--;) push_child(*ms[i]);
+    }
 
-    ChainMap(Map& map, Maps&... maps) : map(map), B(maps...) {}
-    ChainMap(Map& map, const B& cmp) : map(map), B(cmp) {}
+    size_t depth() const { return levels.size(); }
 
-    Map& get_map(size_t i) { return i ? B::get_map(i - 1) : map; }
+    Map& get_map(size_t i) {
+        if (i >= levels.size())
+            throw std::out_of_range(
+                    "dynamic_chainmap::get_map: index out of range");
+        return *levels[levels.size() - 1 - i];
+    }
 
-    template<class NewMap>
-    ChainMap<NewMap, Map, Maps...> new_child(NewMap& new_map) {
-        return {new_map, *this};
+    dynamic_chainmap& push_child(Map& map) {
+        levels.push_back(&map);
+        if (has_filters) {
+            filters.push_back(std::make_shared<Filter>());
+            filters.back()->rebuild(map);
+        }
+        return *this;
     }
 
-    const V& at(const K& k) const {
-        try { return map.at(k); }
-        catch (const std::out_of_range &) {
-            return static_cast<const B*>(this)->at(k);
+    dynamic_chainmap& pop_child() {
+        if (levels.empty())
+            throw std::out_of_range("dynamic_chainmap::pop_child: no maps");
+        levels.pop_back();
+        if (has_filters) filters.pop_back();
+        return *this;
+    }
+
+    dynamic_chainmap new_child(Map& map) const {
+        dynamic_chainmap d = *this;
+        return d.push_child(map), d;
+    }
+
+    // Rebuild the filter of the n-th map, or of every map.
+    void rebuild_filter(size_t i) {
+        if (has_filters) filter(levels.size() - 1 - i).rebuild(get_map(i));
+    }
+    void rebuild_filters() {
+        for (size_t i = 0; i < levels.size(); ++i) rebuild_filter(i);
+    }
+
+    Stats stats() const { return stats_; }
+    void reset_stats() { stats_ = Stats(); }
+
+    static constexpr bool transparent = is_transparent_map<Map>::value;
+
+    template<class Q = K>
+    const std::pair<const K, V>* find_item(const Q& q) const {
+        const auto& k = chain_key<dynamic_chainmap>(q);
+        return find_item(k, Filter::hash(k), levels.size());
+    }
+
+    template<class Q = K>
+    const V* find(const Q& k) const {
+        auto e = find_item(k);
+        return e ? &e->second : nullptr;
+    }
+
+    chain_ref<dynamic_chainmap> ref(const K& k) {
+        Map& map = front();
+        auto i = map.find(k);
+        if (i != map.end()) {
+            stats_.chain_hit(0);
+            return {*this, k, &*i};
         }
+        return {*this, k, find_item(k, Filter::hash(k), levels.size() - 1)};
     }
 
-    V& operator[](const K& k) {
-        try { return map[k] = at(k); }
-        catch (const std::out_of_range &) {
-            return map[k];
+    template<class Q = K>
+    const V& at(const Q& k) const {
+        if (const V* v = find(k)) return *v;
+        throw std::out_of_range("dynamic_chainmap::at: key not found");
+    }
+
+    template<class Q = K>
+    V& operator[](const Q& q) {
+        const auto& k = chain_key<dynamic_chainmap>(q);
+        Map& map = front();
+        auto i = map.find(k);
+        if (i != map.end()) {
+            stats_.chain_hit(0);
+            return i->second;
         }
+        size_t h = Filter::hash(k);
+        if (auto e = find_item(k, h, levels.size() - 1))
+            return inserted(h, find_or_emplace(map, k, e->second)
+                                       .first->second);
+        return inserted(h, find_or_emplace(map, k).first->second);
     }
 
-    size_t erase(const K& k) { return map.erase(k); }
+    template<class... Args>
+    V& emplace_front(const K& k, Args&&... args) {
+        auto i = front().try_emplace(k, std::forward<Args>(args)...);
+        if (!i.second) return i.first->second;
+        return inserted(Filter::hash(k), i.first->second);
+    }
+
+    size_t erase(const K& k) { return front().erase(k); }
+
+    template<class F>
+    void for_each_map(F&& f) {
+        for (size_t i = levels.size(); i--;) f(*levels[i]);
+    }
+
+    // Visits the maps from the first to the last, skipping keys that an
+    // earlier map holds.
+    struct const_iterator {
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const K, V> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const dynamic_chainmap* d;
+        size_t level;
+        typename Map::const_iterator i;
+
+        reference operator*() const { return *i; }
+        pointer operator->() const { return &*i; }
+        const_iterator& operator++() {
+            ++i;
+            skip();
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator t = *this;
+            ++*this;
+            return t;
+        }
+        bool operator==(const const_iterator& o) const {
+            return level == o.level && (!level || i == o.i);
+        }
+        bool operator!=(const const_iterator& o) const { return !(*this == o); }
+
+        // level counts the maps left, including the current one.
+        void skip() {
+            for (; level; --level) {
+                const Map& m = *d->levels[level - 1];
+                for (; i != m.end(); ++i)
+                    if (!d->shadowed(i->first, level)) return;
+                if (level > 1) i = std::as_const(*d->levels[level - 2]).begin();
+            }
+        }
+    };
+
+    const_iterator begin() const {
+        if (levels.empty()) return end();
+        const_iterator i{this, levels.size(),
+                         std::as_const(*levels.back()).begin()};
+        i.skip();
+        return i;
+    }
+    const_iterator end() const { return {this, 0, {}}; }
+
+    cached_chainmap<dynamic_chainmap> cached() const {
+        return cached_chainmap<dynamic_chainmap>(*this);
+    }
 
     void one_map(Map& one) {
-        one.insert(map.begin(), map.end());
-        B::one_map(one);
+        for_each_map([&one](Map& m) { one.insert(m.begin(), m.end()); });
     }
 
+    // The result uses the allocator of the first map.
     Map one_map() {
-        Map one;
+        Map one = levels.empty() ? Map() : Map(front().get_allocator());
         one_map(one);
         return one;
     }
-};
-
-template<class Map>
-struct ChainMap<Map> {
-    typedef typename Map::key_type K;
-    typedef typename Map::mapped_type V;
 
-    Map& map;
+private:
+    static constexpr bool has_filters = !std::is_empty<Filter>::value;
 
-    ChainMap(Map& map) : map(map) {}
+    small_vector<Map*, 8> levels;
+    std::vector<std::shared_ptr<Filter>> filters;
+    [[no_unique_address]] mutable Stats stats_;
 
-    Map& get_map(size_t i) {
-        if (i) throw std::out_of_range("ChainMap::get_map: index out of range");
-        return map;
+    Filter& filter(size_t i) {
+        static Filter none;
+        return has_filters ? *filters[i] : none;
+    }
+    const Filter& filter(size_t i) const {
+        return const_cast<dynamic_chainmap*>(this)->filter(i);
     }
 
-    template<class NewMap>
-    ChainMap<NewMap, Map> new_child(NewMap& new_map) { return {new_map, map}; }
-
-    const V& at(const K& k) const { return map.at(k); }
-
-    V& operator[](const K& k) { return map[k]; }
+    // Whether a map stored above index n - 1 holds k.
+    bool shadowed(const K& k, size_t n) const {
+        if (n == levels.size()) return false;
+        size_t h = Filter::hash(k);
+        for (size_t i = n; i < levels.size(); ++i) {
+            if (!filter(i).may_contain(h)) continue;
+            if (levels[i]->find(k) != levels[i]->end()) return true;
+        }
+        return false;
+    }
 
-    size_t erase(const K& k) { return map.erase(k); }
+    // Searches the maps stored below index n, that is from the n-th last.
+    template<class Q>
+    const std::pair<const K, V>* find_item(const Q& k, size_t h,
+                                           size_t n) const {
+        for (size_t i = n; i--;) {
+            if (!filter(i).may_contain(h)) {
+                stats_.filtered();
+                continue;
+            }
+            auto j = levels[i]->find(k);
+            if (j != levels[i]->end())
+                return stats_.chain_hit(levels.size() - 1 - i), &*j;
+        }
+        stats_.chain_miss();
+        return nullptr;
+    }
 
-    void one_map(Map& one) { one.insert(map.begin(), map.end()); }
+    Map& front() {
+        if (levels.empty())
+            throw std::out_of_range("dynamic_chainmap: no maps");
+        return *levels.back();
+    }
 
-    Map one_map() { return map; }
+    V& inserted(size_t h, V& v) {
+        if (!filter(levels.size() - 1).insert(h)) rebuild_filter(0);
+        return v;
+    }
 };
 
+// Smoke tests, each printing what its comment says. Define COLLECTIONS_NO_MAIN
+// to include this file elsewhere, as the benchmarks do.
+#ifndef COLLECTIONS_NO_MAIN
 int main() {
     //-----defaultdict tests-----
     std::cout << "defaultdict tests:\n";
@@ -226,6 +4239,76 @@ int main() {
     // defaultdict value access: 1-1
     std::cout << dd['a'] << dd.at('b') << '\n';
 
+    // defaultdict::try_emplace only applies f on a miss: 1-12
+    dd.try_emplace('a'), dd.try_emplace('c', 2);
+    std::cout << dd['a'] << dd['b'] << dd['c'] << '\n';
+
+    // flat_defaultdict value access: 1-1
+    flat_defaultdict<char, int> fdd([]() { return -1; }, {{'a', 1}});
+    std::cout << fdd['a'] << fdd.at('b') << '\n';
+
+    // flat_map copies keep the deleted slots of probe chains: 784 784
+    flat_map<int, int> efm;
+    efm.reserve(896);
+    for (int i = 0; i < 896; ++i) efm[i] = i;
+    for (int i = 0; i < 896; i += 8) efm.erase(i);
+    flat_map<int, int> ecp(efm);
+    int kept = 0;
+    for (int i = 0; i < 896; ++i) kept += int(ecp.count(i));
+    std::cout << ecp.size() << ' ' << kept << '\n';
+
+    // Stateful and key taking factories: 12 1 3 aa
+    int made = 0;
+    auto sdd = make_defaultdict<char>([&made]() { return ++made; });
+    auto kdd = make_defaultdict<std::string, flat_map>(
+            [](const std::string& k) { return std::vector<char>(k.size()); });
+    std::cout << sdd['x'] << sdd['y'] << ' ' << sdd['x'] << ' '
+              << kdd["abc"].size() << ' ';
+    kdd["ab"].assign(2, 'a');
+    std::cout << std::string(kdd["ab"].begin(), kdd["ab"].end()) << '\n';
+
+    // defaultdict::get_many: 1 1 -1 3
+    std::vector<char> gk{'a', 'q', 'a'};
+    std::vector<int*> gv;
+    fdd.get_many(gk, std::back_inserter(gv));
+    *gv[1] += 2;
+    std::cout << *gv[0] << ' ' << (gv[0] == gv[2]) << ' ' << fdd['q'] - 2 << ' '
+              << fdd.size() << '\n';
+
+    // Bounded clock_defaultdict and concurrent_defaultdict:
+    // 3 1 2 3 1 9 16 9 4/7 2 400 100 100
+    int computed = 0;
+    auto memo = make_clock_defaultdict<int>(2, [&computed](int k) {
+        return ++computed, k * k;
+    });
+    for (int k : {1, 2, 1, 3}) memo[k];
+    lookup_stats ms = memo.stats();
+    std::cout << ms.defaults << ' ' << ms.evictions << ' ' << memo.size() << ' '
+              << computed << ' ' << memo.count(3) << ' ';
+    std::vector<int*> mptrs;
+    memo.get_many(std::vector<int>{3, 4, 3}, std::back_inserter(mptrs));
+    std::cout << *mptrs[0] << ' ' << *mptrs[1] << ' ' << *mptrs[2] << ' ';
+    ms = memo.stats();
+    std::cout << ms.defaults << '/' << ms.dict_lookups << ' ';
+    try {
+        memo.get_many(std::vector<int>{5, 6, 7}, std::back_inserter(mptrs));
+    } catch (const std::length_error&) {
+        std::cout << memo.size() << ' ';
+    }
+    std::atomic<int> shared_calls{0};
+    auto ident = [&shared_calls](int k) { return ++shared_calls, k; };
+    concurrent_defaultdict<int, int, decltype(ident)> cdd(1000, ident, 4);
+    std::vector<std::thread> cts;
+    for (int i = 0; i < 4; ++i) {
+        cts.emplace_back([&cdd]() {
+            for (int k = 0; k < 100; ++k) cdd.get(k);
+        });
+    }
+    for (auto &t : cts) t.join();
+    ms = cdd.stats();
+    std::cout << ms.dict_lookups << ' ' << ms.defaults << ' ' << shared_calls
+              << '\n';
+
     //-----Counter tests-----
     std::cout << "\nCounter tests:\n";
     Counter<char> ct{{'a', 1}, {'b', 1}};
@@ -247,10 +4330,275 @@ int main() {
     ct -= {{'b', 2}, {'d', 2}};
     std::cout << '\n';
     for (char c : ct.elements()) std::cout << c;
+
+    // Counter::runs and expand_into agree with elements(): c2a3 ccaaa
+    std::cout << ' ';
+    for (const auto& t : ct.runs()) std::cout << t.first << t.second;
+    std::string expanded;
+    ct.expand_into(std::back_inserter(expanded));
+    std::cout << ' ' << expanded;
     
     // Counter::total: 4
     std::cout << '\n' << ct.total() << '\n';
 
+    // Counter::update from iterators and ranges: c4a3b2
+    Counter<char> uct;
+    std::string str = "aaabbc";
+    uct.update(str.begin(), str.end()).update(std::vector<char>{'c', 'c', 'c'});
+    for (const auto& t : uct.most_common()) std::cout << t.first << t.second;
+    std::cout << '\n';
+
+    // Counter::from_parallel and merge_parallel, on one thread when lookups
+    // record stats: c8a6b4 4
+    Counter<char> pct = Counter<char>::from_parallel(str, 3);
+    pct.merge_parallel(Counter<char>{{'c', 3}}, 2).merge_parallel(uct, 2);
+    for (const auto& t : pct.most_common()) std::cout << t.first << t.second;
+    flat_counter<char, int, lookup_stats> spct{{'a', 1}, {'b', 1}};
+    spct.merge_parallel(flat_counter<char, int, lookup_stats>{{'a', 3}}, 2);
+    std::cout << ' ' << spct['a'] << '\n';
+
+    // Counter::most_common into a reused vector: a3c2
+    ct.most_common(v, 2);
+    for (const auto& t : v) std::cout << t.first << t.second;
+    std::cout << '\n';
+
+    // flat_counter keeps the Counter interface: a3 6
+    flat_counter<char> fct;
+    fct.update({'a', 'b', 'a', 'c', 'a', 'b'});
+    v = fct.most_common(1);
+    std::cout << v[0].first << v[0].second << ' ' << fct.total() << '\n';
+
+    // pmr::flat_counter passes its memory resource on: a3 111
+    std::pmr::monotonic_buffer_resource res;
+    pmr::flat_counter<char> mct(&res);
+    mct.update({'a', 'b', 'a', 'a'});
+    auto msum = mct + mct;
+    auto mv = mct.most_common(1);
+    std::cout << mv[0].first << mv[0].second << ' '
+              << (msum.get_allocator().resource() == &res)
+              << (mv.get_allocator().resource() == &res)
+              << (msum.most_common().get_allocator().resource() == &res)
+              << '\n';
+
+    // ranked_counter::most_common: b3a2 c5b3 9
+    ranked_counter<char> rc;
+    rc.update({'a', 'b', 'b', 'c', 'b', 'a'});
+    for (const auto& t : rc.most_common(2)) std::cout << t.first << t.second;
+    --rc['a'], rc['c'] += 4;
+    std::cout << ' ';
+    for (const auto& t : rc.most_common(2)) std::cout << t.first << t.second;
+    std::cout << ' ' << rc.total() << '\n';
+
+    // concurrent_counter across threads: 4000 3 b2000
+    concurrent_counter<char> cc(4);
+    std::vector<std::thread> ts;
+    for (int i = 0; i < 4; ++i) {
+        ts.emplace_back([&cc, i]() {
+            for (int j = 0; j < 1000; ++j) cc.increment("abc"[i % 2 + j % 2]);
+        });
+    }
+    for (auto &t : ts) t.join();
+    v = cc.most_common(1);
+    std::cout << cc.total() << ' ' << cc.size() << ' ' << v[0].first
+              << v[0].second << '\n';
+
+    // epoch_counter snapshots: 0 a2b1 3 4 2
+    epoch_counter<char> ec(4);
+    ec.update({'a', 'b', 'a'});
+    auto es0 = ec.snapshot();
+    ec.publish();
+    auto es1 = ec.snapshot();
+    ec.increment('c');
+    std::cout << es0->size() << ' ';
+    for (const auto& t : es1->most_common()) std::cout << t.first << t.second;
+    es0.reset();
+    long seen = 0;
+#ifdef __cpp_lib_coroutine
+    struct detached {
+        struct promise_type {
+            detached get_return_object() { return {}; }
+            std::suspend_never initial_suspend() { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+    auto exporter = [&seen](epoch_counter<char>& c) -> detached {
+        seen = (co_await c.next_snapshot())->total();
+    };
+    exporter(ec);
+    ec.publish();
+#else
+    seen = ec.publish()->total();
+#endif
+    std::cout << ' ' << es1->total() << ' ' << seen << ' ' << ec.epoch()
+              << '\n';
+
+    // delta_counter checkpoints through dump, load_add and merge_tree:
+    // a1b2 0 a0b2c3
+    delta_counter<char> dn;
+    dn.update({'a', 'b', 'b'});
+    auto dl1 = dn.checkpoint();
+    dn.increment('a', -1), dn.increment('c');
+    std::stringstream dss;
+    dump(dss, dl1), dump(dss, dn.checkpoint());
+    Counter<char> central, dl2;
+    load_add(dss, central), load(dss, dl2);
+    central += Counter<char>::merge_tree({dl2, {{'c', 2}}}, 2);
+    for (const auto& t : std::map<char, int>(dl1.begin(), dl1.end()))
+        std::cout << t.first << t.second;
+    std::cout << ' ' << dn.changes().size() << ' ';
+    for (const auto& t : std::map<char, int>(central.begin(), central.end()))
+        std::cout << t.first << t.second;
+    std::cout << '\n';
+
+    // Counter over an ordered map, updated from ranges and loaded: a3b2c1 3
+    Counter<char, std::map<char, int>> oct;
+    std::string ostr = "abcab";
+    oct.update(ostr).update(ostr.begin(), ostr.begin() + 1);
+    std::stringstream oss;
+    dump(oss, oct);
+    Counter<char, std::map<char, int>> oct2;
+    load(oss, oct2);
+    for (const auto& t : oct2) std::cout << t.first << t.second;
+    std::cout << ' ' << oct2.size() << '\n';
+
+    // Counter::increment_many: a3b1 a2b1
+    flat_counter<char> bct;
+    Counter<char> ict2;
+    std::string bk = "abaa";
+    bct.increment_many(bk), ict2.increment_many(bk.begin() + 1, bk.end());
+    for (const auto& t : bct.most_common()) std::cout << t.first << t.second;
+    std::cout << ' ';
+    for (const auto& t : ict2.most_common()) std::cout << t.first << t.second;
+    std::cout << '\n';
+
+    // Narrow, saturating and floating point counts: 400 a255b0 2.5
+    flat_counter<char, uint8_t> nct{{'a', 200}, {'b', 200}};
+    flat_counter<char, saturating<uint8_t>> sct;
+    sct['a'] += 300, --sct['b'];
+    Counter<char, std::unordered_map<char, double>> dct{{'a', 1.5}};
+    dct['b'] += 1;
+    std::cout << nct.total() << ' ';
+    for (const auto& t : sct.most_common())
+        std::cout << t.first << int(t.second);
+    std::cout << ' ' << dct.total() << '\n';
+
+    // approx_counter keeps the heavy hitters, and merges:
+    // a6b3 a8 7 16 Dimensions checked
+    approx_counter<char> ac(256, 4, 2), ac2(256, 4, 2);
+    ac.update(std::string("abacabadaba"));
+    for (const auto& t : ac.most_common()) std::cout << t.first << t.second;
+    ac2 += Counter<char>{{'c', 3}, {'a', 2}};
+    ac += ac2;
+    std::cout << ' ';
+    for (const auto& t : ac.most_common(1)) std::cout << t.first << t.second;
+    std::cout << ' ' << ac.count('b') + ac.count('c') << ' ' << ac.total()
+              << ' ';
+    try {
+        approx_counter<char> wide(512);
+        ac += wide;
+    } catch (const std::invalid_argument&) {
+        std::cout << "Dimensions checked\n";
+    }
+
+    // Tokens counted as std::string_view, across chunk boundaries:
+    // to3be2 or1 5to3
+    string_counter<> tct;
+    tct.update_tokens("to be or not\tto be  to\n");
+    std::istringstream tis("to be or not to be question to");
+    Counter<std::string> ict;
+    ict.ingest(tis, 4);
+    for (const auto& t : tct.most_common(2)) std::cout << t.first << t.second;
+    std::cout << " or" << tct.find(std::string_view("or"))->second << ' '
+              << ict.size() << ict.most_common(1)[0].first
+              << ict.most_common(1)[0].second << '\n';
+
+    // dump and load, and mapped_counter reading a file in place:
+    // 13 31 hi:there 3 1001 2 -1 0 Format checked twice
+    Counter<int> ic{{1000, 3}, {1001, 2}, {-1, 1}};
+    std::stringstream ss;
+    dump(ss, ic);
+    flat_counter<int> ic2;
+    load(ss, ic2);
+    defaultdict<std::string, std::string> sd([]() { return std::string(); });
+    sd["hi"] = "there";
+    std::stringstream sds;
+    dump(sds, sd);
+    sd.clear();
+    load(sds, sd);
+    std::cout << ss.str().size() << ' ' << ic2.size() << ic2[-1] << ' '
+              << sd.begin()->first << ':' << sd.begin()->second << ' ';
+#if __has_include(<sys/mman.h>)
+    {
+        std::ofstream f("collections_test.bin", std::ios::binary);
+        dump_mapped(f, ic);
+    }
+    mapped_counter<int> mc("collections_test.bin");
+    auto mcv = mc.most_common(2);
+    std::cout << mc.at(1000) << ' ' << mcv[1].first << ' ' << mcv[1].second
+              << ' ' << *mc.elements().begin() << ' ' << mc.count(5) << ' ';
+    try {
+        mapped_counter<int, long long> bad("collections_test.bin");
+    } catch (const std::runtime_error&) {
+        std::cout << "Format checked";
+    }
+    {
+        mapped_header h = {{'C', 'L', 'C', 'M'}, mapped_header::native_order,
+                           sizeof(int), alignof(int), sizeof(int),
+                           alignof(int), uint64_t(1) << 62};
+        std::ofstream f("collections_test.bin", std::ios::binary);
+        f.write(reinterpret_cast<const char*>(&h), sizeof h);
+    }
+    try {
+        mapped_counter<int> bad("collections_test.bin");
+    } catch (const std::runtime_error&) {
+        std::cout << " twice\n";
+    }
+    std::remove("collections_test.bin");
+#endif
+
+    // Sizes too large to make room for:
+    // load: truncated input load: truncated input flat_map::reserve
+    std::stringstream hss;
+    hss.write("CLCT\1", 5);
+    binary_codec::put_varint(hss, ~0ULL);
+    try {
+        load(hss, ic2);
+    } catch (const std::runtime_error& e) {
+        std::cout << e.what() << ' ';
+    }
+    std::stringstream lss;
+    lss.write("CLCT\1", 5);
+    binary_codec::put_varint(lss, 1);
+    binary_codec::put_varint(lss, uint64_t(1) << 62);
+    try {
+        load(lss, sd);
+    } catch (const std::runtime_error& e) {
+        std::cout << e.what() << ' ';
+    }
+    try {
+        ic2.reserve(size_t(-1));
+    } catch (const std::length_error& e) {
+        std::cout << e.what() << '\n';
+    }
+
+    // Python's &, |, subtract, unary + and -, and merges erasing the counts
+    // left at zero or below: a1b1 a3b2c1 a2b-1c-1 a2 b1c1 a5 42
+    typedef Counter<char, std::map<char, int>> sorted_counter;
+    sorted_counter pya{{'a', 3}, {'b', 1}}, pyb{{'a', 1}, {'b', 2}, {'c', 1}};
+    auto show = [](const sorted_counter& c) {
+        for (auto &t : c) std::cout << t.first << t.second;
+        std::cout << ' ';
+    };
+    show(pya & pyb), show(pya | pyb);
+    sorted_counter pyd = pya;
+    show(pyd.subtract(pyb)), show(+pyd), show(-pyd);
+    show(pya.add(pyd, nonpositive::erase));
+    flat_counter<char> pyf{{'x', 2}, {'y', 1}}, pyg(pyf);
+    pyf += pyg;
+    std::cout << pyf['x'] << pyf['y'] << '\n';
+
     //-----ChainMap tests-----
     std::cout << "\nChainMap tests:\n";
     std::map<char, int> mp1{{'a', 1}, {'b', 2}},
@@ -265,6 +4613,10 @@ int main() {
     // ChainMap::at: 346
     std::cout << '\n' << cmp.at('b') << cmp.at('c') << cmp.at('d') << '\n';
 
+    // ChainMap::find: 4 not found
+    std::cout << *cmp.find('c') << (cmp.find('a') ? " found" : " not found")
+              << '\n';
+
     // ChainMap::at bounds checking
     try { cmp.at('a'); } catch (const std::out_of_range &) {
         std::cout << "Bounds checked\n";
@@ -281,8 +4633,140 @@ int main() {
     std::cout << '\n';
     for (auto &t : mp3) std::cout << t.first << t.second;
 
+    // ChainMap::ref copies into the first mapping on write only: 6 0 76 9
+    auto r = cmp.ref('c');
+    std::cout << '\n' << r.get() << ' ' << mp2.count('c') << ' ';
+    r.mut() += 1;
+    std::cout << mp2.at('c') << mp3.at('c');
+    cmp.erase('c');
+    auto r2 = cmp.ref('c');
+    cmp['c'] = 5, r2 = 9;
+    std::cout << ' ' << cmp.at('c');
+    cmp.erase('c');
+
+    // ChainMap iteration skips the keys of earlier mappings: a1b2d7c6
+    std::cout << '\n';
+    for (auto &t : n_cmp) std::cout << t.first << t.second;
+
+    // ChainMap::cached tracks writes and get_map: 126 6 9-
+    auto ccmp = n_cmp.cached();
+    std::cout << '\n' << ccmp.at('a') << ccmp.at('b') << ccmp.at('c');
+    ccmp.erase('a'), ccmp['b'] = 6;
+    std::cout << ' ' << ccmp.at('b') << ' ';
+    ccmp.get_map(2)['e'] = 9;
+    std::cout << ccmp.at('e') << (ccmp.find('a') ? '+' : '-');
+
+    // ChainMap::cached over a flat_map that grows under the view: 1 496
+    flat_map<int, int> cfront, cback{{-1, 1}};
+    auto fcv = ChainMap<flat_map<int, int>, flat_map<int, int>>(cfront, cback)
+                       .cached();
+    std::cout << '\n' << fcv.at(-1) << ' ';
+    int csum = 0;
+    for (int i = 0; i < 32; ++i) fcv[i] = i;
+    for (int i = 0; i < 32; ++i) csum += fcv.at(i);
+    std::cout << csum;
+
+    // Braced keys, which deduce no type of their own: 3 4 3 3 3
+    typedef std::map<std::pair<int, int>, int> pair_map;
+    pair_map pfront, pback{{{1, 2}, 3}};
+    ChainMap<pair_map, pair_map> pcm(pfront, pback);
+    dynamic_chainmap<pair_map> pdcm(pback);
+    pcm[{1, 2}] += 1;
+    std::cout << '\n' << pback.at({1, 2}) << ' ' << pcm.at({1, 2}) << ' '
+              << *pdcm.find({1, 2}) << ' ' << pdcm.at({1, 2}) << ' '
+              << pdcm[{1, 2}];
+
     // ChainMap::get_map bounds checking
     try { cmp.get_map(2); } catch (const std::out_of_range &) {
         std::cout << "\nBounds checked\n";
     }
+
+    // Transparent lookups through defaultdict, Counter and ChainMap: 2 2 5 3
+    typedef std::map<std::string, int, std::less<>> str_map;
+    defaultdict<std::string, int, flat_map<std::string, int, string_hash,
+                                           std::equal_to<>>>
+            tdd([]() { return 1; });
+    tdd[std::string_view("k")] += 1;
+    string_counter<> stc;
+    stc["k"] += 2;
+    str_map sm1, sm2{{"k", 5}};
+    ChainMap scm(sm1, sm2);
+    scm[std::string_view("k")] -= 2;
+    std::cout << tdd.at(std::string_view("k")) << ' ' << stc["k"] << ' '
+              << sm2.at("k") << ' ' << scm.at("k") << '\n';
+
+    // ChainMap over a compile time table of defaults: 25 1 a1z26
+    static constexpr auto ctab = make_const_table<char, int>(
+            {{'z', 26}, {'a', 0}, {'y', 25}});
+    static_assert(ctab.at('y') == 25 && !ctab.count('b'), "const_table");
+    std::map<char, int> cm_over{{'a', 1}};
+    ChainMap ctcm(cm_over, ctab);
+    std::cout << ctcm.at('y') << ' ' << ctcm.at('a');
+    ctcm['z'] += 0;
+    std::cout << ' ';
+    for (auto &t : cm_over) std::cout << t.first << t.second;
+    std::cout << '\n';
+
+    // freeze makes read only maps, hashed or in Eytzinger order, that chains
+    // take as levels: 3 0 b3 e7 21
+    Counter<char> fzc{{'a', 3}, {'b', 2}};
+    auto fzh = freeze(fzc);
+    std::map<char, int> fzm{{'b', 3}, {'e', 7}, {'c', 1}}, fz_front;
+    auto fze = freeze(fzm);
+    std::cout << fzh.at('a') << ' ' << fzh.count('c') << " b" << fze.at('b')
+              << " e" << fze.at('e') << ' ';
+    ChainMap fzcm(fz_front, fzh, fze);
+    std::cout << fzcm.at('b') << fzcm.at('c') << '\n';
+
+    //-----dynamic_chainmap tests-----
+    std::cout << "\ndynamic_chainmap tests:\n";
+    std::map<char, int> dm1{{'a', 1}, {'b', 2}}, dm2{{'b', 3}, {'c', 4}};
+    dynamic_chainmap<std::map<char, int>> dcm(dm2);
+
+    // dynamic_chainmap::push_child and pop_child: 2 a1b2c4 1 3
+    dcm.push_child(dm1);
+    std::cout << dcm.depth() << ' ';
+    for (auto &t : dcm.one_map()) std::cout << t.first << t.second;
+    std::cout << ' ' << dcm.at('a') << ' ' << dcm.pop_child().at('b') << '\n';
+
+    // dynamic_chainmap modifications only operate on the first mapping:
+    // a1b2c5 b3c4
+    dcm.push_child(dm1)['c'] += 1;
+    for (auto &t : dm1) std::cout << t.first << t.second;
+    std::cout << ' ';
+    for (auto &t : dm2) std::cout << t.first << t.second;
+    std::cout << '\n';
+
+    // dynamic_chainmap iteration skips the keys of earlier mappings: a1b2c5
+    for (auto &t : dcm) std::cout << t.first << t.second;
+    std::cout << '\n';
+
+    // dynamic_chainmap with Bloom filters: 1c5 d9 5 6
+    dynamic_chainmap<std::map<char, int>, bloom_filter<char>> fcm(dm1, dm2);
+    std::cout << fcm.at('a') << (fcm.find('e') ? "e" : "") << 'c' << fcm['c'];
+    fcm.get_map(1)['d'] = 9, fcm.rebuild_filter(1);
+    std::cout << " d" << fcm.at('d');
+
+    // Children and cached views of a filtered chain share its filters: 5 6
+    auto fch = fcm.new_child(dm2);
+    fcm['x'] = 5, fcm.cached()['y'] = 6;
+    std::cout << ' ' << *fch.find('x') << ' ' << *fcm.find('y') << '\n';
+
+    // Lookup stats, as the depths of hits and the misses of chains, and the
+    // defaults and probes of a flat_defaultdict: 1 1 1 2 3/5 5
+    dynamic_chainmap<std::map<char, int>, no_filter, lookup_stats>
+            stcm(dm1, dm2);
+    stcm.find('a'), stcm.find('d'), stcm.find('z');
+    lookup_stats cs = stcm.stats();
+    std::cout << cs.depth[0] << ' ' << cs.depth[1] << ' ' << cs.chain_misses;
+    ChainMap<std::map<char, int>, std::map<char, int>> stcm2(dm1, dm2);
+    cs = lookup_stats();
+    stcm2.find('a', cs), stcm2.find('d', cs);
+    std::cout << ' ' << cs.depth[0] + cs.depth[1] << ' ';
+    flat_defaultdict<int, int, int (*)(), lookup_stats> stdd([] { return 0; });
+    for (int i : {1, 2, 1, 3, 1}) ++stdd[i];
+    cs = stdd.stats();
+    std::cout << cs.defaults << '/' << cs.dict_lookups << ' ' << cs.lookups
+              << '\n';
 }
+#endif